@@ -22,3 +22,10 @@ pkg_check_modules(flann REQUIRED IMPORTED_TARGET flann)
 # Optional libraries
 find_package(libpointmatcher 1.3.1)
 find_package(GDAL)
+find_package(GTSAM)
+
+# Optional GPU registration backend (requires fast_gicp built with CUDA)
+option(SLAM3D_GPU_REGISTRATION "Build the GPU registration backend" OFF)
+if(SLAM3D_GPU_REGISTRATION)
+	find_package(fast_gicp REQUIRED)
+endif()
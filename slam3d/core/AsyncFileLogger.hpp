@@ -0,0 +1,172 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM_ASYNC_FILELOGGER_HPP
+#define SLAM_ASYNC_FILELOGGER_HPP
+
+#include "Logger.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+namespace slam3d
+{
+	/**
+	 * @class AsyncFileLogger
+	 * @brief A logger that writes messages to a file from a background thread.
+	 * @details Messages are placed in a fixed-size lock-free ring buffer, so
+	 * the calling thread never blocks on file I/O. A writer thread drains the
+	 * buffer to the log file. When the buffer is full, messages are dropped
+	 * and the number of drops is reported once the writer catches up again.
+	 */
+	class AsyncFileLogger : public Logger
+	{
+	public:
+		/**
+		 * @brief Constructor for an AsyncFileLogger.
+		 * @param c clock to get timestamps for messages
+		 * @param f filename for the loggers log-file
+		 * @param capacity number of messages the ring buffer can hold
+		 */
+		AsyncFileLogger(Clock c, std::string f, size_t capacity = 1024)
+		: Logger(c), mSlots(capacity), mHead(0), mTail(0), mDropped(0), mShutdown(false)
+		{
+			for(size_t i = 0; i < capacity; ++i)
+			{
+				mSlots[i].sequence.store(i, std::memory_order_relaxed);
+			}
+			mLogFile.open(f.c_str());
+			mWriter = std::thread(&AsyncFileLogger::run, this);
+		}
+
+		~AsyncFileLogger()
+		{
+			mShutdown.store(true, std::memory_order_release);
+			mWriter.join();
+			mLogFile.close();
+		}
+
+		/**
+		 * @brief Queues a message for the writer thread.
+		 * @param lvl the message's log-level
+		 * @param message the message to be written
+		 */
+		virtual void message(LOG_LEVEL lvl, const std::string& message)
+		{
+			if(lvl < mLogLevel)
+				return;
+
+			Slot* slot;
+			size_t pos = mHead.load(std::memory_order_relaxed);
+			for(;;)
+			{
+				slot = &mSlots[pos % mSlots.size()];
+				size_t seq = slot->sequence.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+				if(diff == 0)
+				{
+					if(mHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}else if(diff < 0)
+				{
+					// Buffer is full; dropping is preferable to blocking
+					// the mapping threads on file I/O.
+					mDropped.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}else
+				{
+					pos = mHead.load(std::memory_order_relaxed);
+				}
+			}
+			slot->level = lvl;
+			slot->stamp = mClock.now();
+			slot->text = message;
+			slot->sequence.store(pos + 1, std::memory_order_release);
+		}
+
+	private:
+		struct Slot
+		{
+			std::atomic<size_t> sequence;
+			LOG_LEVEL level;
+			timeval stamp;
+			std::string text;
+		};
+
+		static const char* label(LOG_LEVEL lvl)
+		{
+			switch(lvl)
+			{
+			case DEBUG:   return "[DEBUG]";
+			case INFO:    return "[INFO ]";
+			case WARNING: return "[WARN ]";
+			case ERROR:   return "[ERROR]";
+			default:      return "[FATAL]";
+			}
+		}
+
+		void run()
+		{
+			for(;;)
+			{
+				Slot& slot = mSlots[mTail % mSlots.size()];
+				size_t seq = slot.sequence.load(std::memory_order_acquire);
+				if(seq == mTail + 1)
+				{
+					mLogFile << label(slot.level) << "[" << slot.stamp.tv_sec << "."
+					         << slot.stamp.tv_usec << "] " << slot.text << "\n";
+					slot.text.clear();
+					slot.sequence.store(mTail + mSlots.size(), std::memory_order_release);
+					mTail++;
+					continue;
+				}
+
+				// Buffer is drained; report drops, flush and wait for new messages
+				size_t dropped = mDropped.exchange(0, std::memory_order_relaxed);
+				if(dropped > 0)
+				{
+					mLogFile << "[WARN ] Dropped " << dropped << " messages, the ring buffer was full.\n";
+				}
+				mLogFile.flush();
+				if(mShutdown.load(std::memory_order_acquire))
+					return;
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+
+		std::ofstream mLogFile;
+		std::vector<Slot> mSlots;
+		std::atomic<size_t> mHead;
+		size_t mTail;
+		std::atomic<size_t> mDropped;
+		std::atomic<bool> mShutdown;
+		std::thread mWriter;
+	};
+}
+
+#endif
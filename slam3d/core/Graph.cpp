@@ -24,19 +24,84 @@
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "Graph.hpp"
+#include "MeasurementStorage.hpp"
+#include "Metrics.hpp"
+#include "ThreadBudget.hpp"
 
 #include <boost/format.hpp>
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
 using namespace slam3d;
 
+namespace
+{
+	// Helpers for the binary snapshot format used by save() and load().
+	// All values are written in native byte order; snapshots are meant
+	// for restarts on the same machine, not for long-term archival.
+
+	const char kSnapshotMagic[8] = {'S','L','A','M','3','D','G','R'};
+	const uint32_t kSnapshotVersion = 2;
+
+	void writeString(std::ostream& out, const std::string& s)
+	{
+		uint32_t length = s.size();
+		out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+		out.write(s.data(), length);
+	}
+
+	std::string readString(std::istream& in)
+	{
+		uint32_t length = 0;
+		in.read(reinterpret_cast<char*>(&length), sizeof(length));
+		std::string s(length, '\0');
+		in.read(&s[0], length);
+		return s;
+	}
+
+	void writeScalars(std::ostream& out, const ScalarType* data, unsigned count)
+	{
+		out.write(reinterpret_cast<const char*>(data), count * sizeof(ScalarType));
+	}
+
+	void readScalars(std::istream& in, ScalarType* data, unsigned count)
+	{
+		in.read(reinterpret_cast<char*>(data), count * sizeof(ScalarType));
+	}
+
+	void writeTransform(std::ostream& out, const Transform& t)
+	{
+		writeScalars(out, t.matrix().data(), 16);
+	}
+
+	Transform readTransform(std::istream& in)
+	{
+		Transform t;
+		readScalars(in, t.matrix().data(), 16);
+		return t;
+	}
+}
+
 Graph::Graph(Logger* log)
- : mLogger(log), mNeighborIndex(flann::KDTreeSingleIndexParams())
+ : mLogger(log), mNeighborIndex(flann::KDTreeIndexParams())
 {
 	// Initialize some members
-	mSolver = NULL;	
+	mSolver = NULL;
+	mMeasurementStorage = NULL;
+	mThreadBudget = NULL;
+	mMetrics = NULL;
 	mFixNext = false;
 	mOptimized = false;
 	mConstraintsAdded = 0;
+	mLoopClosuresAdded = 0;
+	mLastIndexedVertex = 0;
+	mRebuildIndex = true;
+	mRevision = 0;
+	mPoseRevision = 0;
+	mCorrectionThreshold = 0;
 }
 
 Graph::~Graph()
@@ -48,12 +113,37 @@ void Graph::setSolver(Solver* solver)
 	mSolver = solver;
 }
 
+void Graph::setMeasurementStorage(MeasurementStorage* storage)
+{
+	mMeasurementStorage = storage;
+}
+
+void Graph::setThreadBudget(ThreadBudget* budget)
+{
+	mThreadBudget = budget;
+}
+
+void Graph::setMetrics(Metrics* metrics)
+{
+	mMetrics = metrics;
+}
+
 void Graph::writeGraphToFile(const std::string &name)
 {
 	mLogger->message(ERROR, "Graph writing not implemented!");
 }
 
 bool Graph::optimize(unsigned iterations)
+{
+	if(!computeOptimization(iterations))
+	{
+		return false;
+	}
+	applyCorrections();
+	return true;
+}
+
+bool Graph::computeOptimization(unsigned iterations)
 {
 	if(!mSolver)
 	{
@@ -61,6 +151,14 @@ bool Graph::optimize(unsigned iterations)
 		return false;
 	}
 
+	// Occupy threads from the shared budget for the duration of the
+	// solver run, so concurrent registrations are granted fewer threads.
+	// Only lease what the solver actually uses; reserving all cores for
+	// a single-threaded solve would needlessly starve registrations.
+	ThreadBudget::Lease lease(mThreadBudget, TASK_OPTIMIZATION,
+	                          std::max(1u, mSolver->getThreadsUsed()));
+	Metrics::Timer timer(mMetrics, "graph.optimize");
+
 	// Optimize
 	if(!mSolver->compute(iterations))
 	{
@@ -68,22 +166,42 @@ bool Graph::optimize(unsigned iterations)
 	}
 	mOptimized = true;
 	mConstraintsAdded = 0;
+	mLoopClosuresAdded = 0;
+	return true;
+}
+
+void Graph::applyOptimization()
+{
+	applyCorrections();
+}
 
-	// Retrieve results
-	IdPoseVector res = mSolver->getCorrections();
+void Graph::applyCorrections()
+{
+	// Retrieve results; only vertices that actually moved are reported
+	IdPoseVector res = mSolver->getDeltaCorrections(mCorrectionThreshold);
 	for(IdPoseVector::iterator it = res.begin(); it < res.end(); it++)
 	{
 		unsigned int id = it->first;
 		Transform tf = it->second;
 		try
 		{
-			setCorrectedPose(id, tf);
+			// Direct write without taking the graph lock, as the caller
+			// already holds it, see applyCorrections() in Graph.hpp.
+			getVertexInternal(id).corrected_pose = tf;
 		}catch(std::out_of_range &e)
 		{
 			mLogger->message(ERROR, (boost::format("Vertex with id %1% does not exist!") % id).str());
 		}
 	}
-	return true;
+
+	// If poses have changed, the indexed poses are outdated and downstream
+	// consumers have to be notified via the revision counter.
+	if(!res.empty())
+	{
+		mRebuildIndex = true;
+		mRevision++;
+		mPoseRevision++;
+	}
 }
 
 bool Graph::optimized()
@@ -100,21 +218,30 @@ bool Graph::optimized()
 
 IdType Graph::addVertex(Measurement::Ptr m, const Transform &corrected)
 {
-	// Create the new VertexObject and add it to the PoseGraph
+	// Create the new VertexObject and add it to the PoseGraph.
+	// Labels are not stored; they are generated on demand when exporting.
 	IdType id = mIndexer.getNext();
-	boost::format v_name("%1%:%2%(%3%)");
-	v_name % m->getRobotName() % m->getSensorName() % id;
 	VertexObject vo;
 	vo.index = id;
-	vo.label = v_name.str();
 	vo.corrected_pose = corrected;
-	vo.measurement = m;
+	vo.measurement = std::move(m);
 	addVertex(vo);
-	mLogger->message(INFO, (boost::format("Created vertex %1% (from %2%:%3%).") % id % m->getRobotName() % m->getSensorName()).str());
+	mLogger->message(INFO, [&]{ return (boost::format("Created vertex %1% (from %2%:%3%).") % id % vo.measurement->getRobotName() % vo.measurement->getSensorName()).str(); });
 
 	// Add it to the uuid-index, so we can find it by its uuid
-	mUuidIndex.insert(UuidIndex::value_type(m->getUniqueId(), id));
-	
+	{
+		std::lock_guard<std::mutex> guard(mUuidIndexMutex);
+		mUuidIndex.insert(UuidIndex::value_type(vo.measurement->getUniqueId(), id));
+	}
+	mRevision++;
+
+	// Spill the payload to the out-of-core storage, so it can be
+	// released from memory once the residency budget is exceeded.
+	if(mMeasurementStorage)
+	{
+		mMeasurementStorage->add(vo.measurement);
+	}
+
 	// Add it to the SLAM-Backend for incremental optimization
 	if(mSolver)
 	{
@@ -144,7 +271,7 @@ void Graph::addConstraint(IdType source_id, IdType target_id, Constraint::Ptr c)
 	EdgeObject eo;
 	eo.source = source_id;
 	eo.target = target_id;
-	eo.constraint = c;
+	eo.constraint = std::move(c);
 	addEdge(eo);
 	addToSolver(eo);
 }
@@ -159,8 +286,14 @@ void Graph::replaceConstraint(IdType source_id, IdType target_id, Constraint::Pt
 void Graph::addToSolver(const EdgeObject& eo)
 {
 	mConstraintsAdded++;
-	mLogger->message(INFO, (boost::format("%3% created edge from node %1% to node %2% of type %4%.")
-	 % eo.source % eo.target % eo.constraint->getSensorName() % eo.constraint->getTypeName()).str());
+	if(eo.constraint->getType() == SE3 &&
+	   eo.source + 1 != eo.target && eo.target + 1 != eo.source)
+	{
+		mLoopClosuresAdded++;
+	}
+	mRevision++;
+	mLogger->message(INFO, [&]{ return (boost::format("%3% created edge from node %1% to node %2% of type %4%.")
+	 % eo.source % eo.target % eo.constraint->getSensorName() % eo.constraint->getTypeName()).str(); });
 	
 	// Add it to the SLAM-Backend for incremental optimization
 	if(mSolver)
@@ -173,24 +306,144 @@ void Graph::removeConstraint(IdType source, IdType target, const std::string& se
 {
 	// Remove from graph
 	removeEdge(source, target, sensor);
-	
+	mRevision++;
+
 	// Remove from solver
 	// TODO
 }
 
+void Graph::removeVertex(IdType id)
+{
+	// Marginalize the SE3 constraints through this vertex into composite
+	// constraints between its neighbors, so their relative pose
+	// information is not lost with the vertex.
+	EdgeObjectList edges = getOutEdges(id);
+	EdgeObjectList se3_edges;
+	for(EdgeObjectList::iterator e = edges.begin(); e != edges.end(); ++e)
+	{
+		if(e->constraint->getType() == SE3)
+			se3_edges.push_back(*e);
+	}
+
+	for(std::size_t i = 0; i < se3_edges.size(); i++)
+	{
+		SE3Constraint::Ptr c_i = std::static_pointer_cast<SE3Constraint>(se3_edges[i].constraint);
+		IdType a = (se3_edges[i].source == id) ? se3_edges[i].target : se3_edges[i].source;
+		Transform t_a_id = (se3_edges[i].source == a)
+			? c_i->getRelativePose() : Transform(c_i->getRelativePose().inverse());
+
+		for(std::size_t j = i + 1; j < se3_edges.size(); j++)
+		{
+			SE3Constraint::Ptr c_j = std::static_pointer_cast<SE3Constraint>(se3_edges[j].constraint);
+			IdType b = (se3_edges[j].source == id) ? se3_edges[j].target : se3_edges[j].source;
+			if(a == b)
+				continue;
+			Transform t_id_b = (se3_edges[j].source == id)
+				? c_j->getRelativePose() : Transform(c_j->getRelativePose().inverse());
+
+			// Do not create a composite where an edge already exists
+			std::string sensor = c_i->getSensorName();
+			try
+			{
+				getEdge(a, b, sensor);
+				continue;
+			}catch(InvalidEdge &e){}
+
+			Transform t_a_b = t_a_id * t_id_b;
+			Covariance<6> information =
+				(c_i->getInformation().inverse() + c_j->getInformation().inverse()).inverse();
+			addConstraint(a, b, Constraint::Ptr(new SE3Constraint(sensor, t_a_b, information)));
+		}
+	}
+
+	// Remove the vertex from the graph, the indices and the solver
+	boost::uuids::uuid uuid = getVertex(id).measurement->getUniqueId();
+	removeVertexInternal(id);
+	{
+		std::lock_guard<std::mutex> guard(mUuidIndexMutex);
+		mUuidIndex.erase(uuid);
+	}
+	if(mSolver)
+	{
+		mSolver->removeVertex(id);
+	}
+	mRebuildIndex = true;
+	mRevision++;
+	mLogger->message(INFO, (boost::format("Removed vertex %1% from the graph.") % id).str());
+}
+
+unsigned Graph::sparsify(const std::string& sensor,
+                         float min_translation,
+                         float min_rotation,
+                         unsigned max_removals)
+{
+	VertexObjectList vertices = getVerticesFromSensor(sensor);
+	if(vertices.size() < 3)
+		return 0;
+
+	// Greedily select the vertices to keep; a vertex is redundant when a
+	// kept vertex is within the given thresholds. This compares each
+	// vertex against the kept set, which is fine for an occasional
+	// maintenance operation.
+	std::vector<Transform> kept;
+	std::vector<IdType> redundant;
+	IdType first = vertices.front().index;
+	IdType last = vertices.back().index;
+	for(VertexObjectList::iterator v = vertices.begin(); v != vertices.end(); ++v)
+	{
+		bool keep = (v->index == first || v->index == last || redundant.size() >= max_removals);
+		if(!keep)
+		{
+			keep = true;
+			for(std::vector<Transform>::iterator k = kept.begin(); k != kept.end(); ++k)
+			{
+				Transform delta = k->inverse() * v->corrected_pose;
+				ScalarType angle = Eigen::AngleAxis<ScalarType>(delta.rotation()).angle();
+				if(delta.translation().norm() < min_translation && std::abs(angle) < min_rotation)
+				{
+					keep = false;
+					break;
+				}
+			}
+		}
+		if(keep)
+			kept.push_back(v->corrected_pose);
+		else
+			redundant.push_back(v->index);
+	}
+
+	unsigned removed = 0;
+	for(std::vector<IdType>::iterator id = redundant.begin(); id != redundant.end(); ++id)
+	{
+		try
+		{
+			removeVertex(*id);
+			removed++;
+		}catch(std::exception &e)
+		{
+			mLogger->message(ERROR, (boost::format("Could not remove vertex %1%: %2%") % *id % e.what()).str());
+		}
+	}
+	mLogger->message(INFO, (boost::format("Sparsification removed %1% of %2% vertices from sensor '%3%'.")
+	 % removed % vertices.size() % sensor).str());
+	return removed;
+}
+
 IdType Graph::getIndex(boost::uuids::uuid id) const
 {
+	std::lock_guard<std::mutex> guard(mUuidIndexMutex);
 	return mUuidIndex.at(id);
 }
 
 bool Graph::hasMeasurement(boost::uuids::uuid id) const
 {
+	std::lock_guard<std::mutex> guard(mUuidIndexMutex);
 	return mUuidIndex.find(id) != mUuidIndex.end();
 }
 
 const VertexObject& Graph::getVertex(boost::uuids::uuid id) const
 {
-	return getVertex(mUuidIndex.at(id));
+	return getVertex(getIndex(id));
 }
 
 Transform Graph::getTransform(IdType source, IdType target) const
@@ -200,32 +453,68 @@ Transform Graph::getTransform(IdType source, IdType target) const
 
 void Graph::buildNeighborIndex(const std::set<std::string>& sensors)
 {
-	VertexObjectList vertices;
+	Metrics::Timer timer(mMetrics, "graph.build_neighbor_index");
+
+	// Several link workers may update the index concurrently; flann does
+	// not allow concurrent modification of one index.
+	std::lock_guard<std::mutex> index_guard(mNeighborIndexMutex);
+
+	// A full rebuild is only needed initially, when the indexed sensors
+	// change or when optimize() has invalidated the indexed poses.
+	bool rebuild = mRebuildIndex || sensors != mIndexedSensors;
+
+	// Gather only the IDs and positions of the vertices to be indexed,
+	// without copying the full VertexObjects into a list.
+	std::vector<IdType> ids;
+	std::vector<float> positions;
 	for(auto sensor : sensors)
 	{
-		VertexObjectList v = getVerticesFromSensor(sensor);
-		vertices.insert(vertices.end(), v.begin(), v.end());
+		forEachVertexFromSensor(sensor, [&](const VertexObject& vertex)
+		{
+			if(rebuild || vertex.index > mLastIndexedVertex)
+			{
+				Transform::ConstTranslationPart t = vertex.corrected_pose.translation();
+				ids.push_back(vertex.index);
+				positions.push_back(t[0]);
+				positions.push_back(t[1]);
+				positions.push_back(t[2]);
+			}
+		});
 	}
-	int numOfVertices = vertices.size();
-	if(numOfVertices == 0)
+
+	if(rebuild)
 	{
-		throw std::runtime_error("Cannot build neighbor index, vertex list is empty.");
+		if(ids.empty())
+		{
+			throw std::runtime_error("Cannot build neighbor index, vertex list is empty.");
+		}
+		mNeighborMap.clear();
+		mNeighborPoints.clear();
+		mIndexedSensors = sensors;
+		mLastIndexedVertex = 0;
+		mRebuildIndex = false;
+	}else if(ids.empty())
+	{
+		// Index is already up to date.
+		return;
 	}
-	flann::Matrix<float> points(new float[numOfVertices * 3], numOfVertices, 3);
 
-	IdType row = 0;
-	mNeighborMap.clear();
-	for(VertexObjectList::iterator it = vertices.begin(); it < vertices.end(); ++it)
+	// The index only references the data, so it has to be kept alive.
+	mNeighborPoints.push_back(std::move(positions));
+	flann::Matrix<float> points(mNeighborPoints.back().data(), ids.size(), 3);
+
+	IdType row = mNeighborMap.size();
+	for(IdType id : ids)
 	{
-		Transform::TranslationPart t = it->corrected_pose.translation();
-		points[row][0] = t[0];
-		points[row][1] = t[1];
-		points[row][2] = t[2];
-		mNeighborMap.insert(std::map<IdType, IdType>::value_type(row, it->index));
+		mNeighborMap.insert(std::map<IdType, IdType>::value_type(row, id));
+		mLastIndexedVertex = std::max(mLastIndexedVertex, id);
 		row++;
 	}
-	
-	mNeighborIndex.buildIndex(points);
+
+	if(mNeighborMap.size() == points.rows)
+		mNeighborIndex.buildIndex(points);
+	else
+		mNeighborIndex.addPoints(points);
 }
 
 VertexObjectList Graph::getNearbyVertices(const Transform &tf, float radius) const
@@ -236,8 +525,11 @@ VertexObjectList Graph::getNearbyVertices(const Transform &tf, float radius) con
 	query[0][0] = t[0];
 	query[0][1] = t[1];
 	query[0][2] = t[2];
-	mLogger->message(DEBUG, (boost::format("Doing NN search from (%1%, %2%, %3%) with radius %4%.")%t[0]%t[1]%t[2]%radius).str());
-	
+	mLogger->message(DEBUG, [&]{ return (boost::format("Doing NN search from (%1%, %2%, %3%) with radius %4%.")%t[0]%t[1]%t[2]%radius).str(); });
+
+	// Serialized against concurrent index updates, see buildNeighborIndex()
+	std::lock_guard<std::mutex> index_guard(mNeighborIndexMutex);
+
 	// Find points nearby
 	std::vector< std::vector<int> > neighbors;
 	std::vector< std::vector<NeighborIndex::DistanceType> > distances;
@@ -250,14 +542,271 @@ VertexObjectList Graph::getNearbyVertices(const Transform &tf, float radius) con
 	for(; it < neighbors[0].end(); ++it, ++d)
 	{
 		result.push_back(getVertex(mNeighborMap.at(*it)));
-		mLogger->message(DEBUG, (boost::format(" - vertex %1% nearby (d = %2%)") % mNeighborMap.at(*it) % *d).str());
+		mLogger->message(DEBUG, [&]{ return (boost::format(" - vertex %1% nearby (d = %2%)") % mNeighborMap.at(*it) % *d).str(); });
 	}
 	
-	mLogger->message(DEBUG, (boost::format("Neighbor search found %1% vertices nearby.") % found).str());
+	mLogger->message(DEBUG, [&]{ return (boost::format("Neighbor search found %1% vertices nearby.") % found).str(); });
+	return result;
+}
+
+std::map<IdType, float> Graph::calculateGraphDistances(IdType source,
+                                                       const std::vector<IdType>& targets,
+                                                       float maxDistance)
+{
+	// Fallback for implementations without a batched distance engine
+	std::map<IdType, float> result;
+	for(IdType target : targets)
+	{
+		float distance = calculateGraphDistance(source, target);
+		if(distance <= maxDistance)
+			result[target] = distance;
+	}
 	return result;
 }
 
 void Graph::setCorrectedPose(IdType id, const Transform& pose)
 {
 	getVertexInternal(id).corrected_pose = pose;
+	// The vertex may already be in the neighbor index with its old pose
+	mRebuildIndex = true;
+	mRevision++;
+	mPoseRevision++;
+}
+
+void Graph::save(const std::string& filename)
+{
+	std::ofstream file(filename.c_str(), std::ios::binary);
+	if(!file.is_open())
+	{
+		throw std::runtime_error((boost::format("Could not open %1% for writing.") % filename).str());
+	}
+
+	file.write(kSnapshotMagic, sizeof(kSnapshotMagic));
+	file.write(reinterpret_cast<const char*>(&kSnapshotVersion), sizeof(kSnapshotVersion));
+
+	// Write all vertices with their measurement payload
+	VertexObjectList vertices = getAllVertices();
+	uint32_t vertex_count = vertices.size();
+	file.write(reinterpret_cast<const char*>(&vertex_count), sizeof(vertex_count));
+	for(VertexObjectList::iterator v = vertices.begin(); v != vertices.end(); ++v)
+	{
+		uint32_t index = v->index;
+		file.write(reinterpret_cast<const char*>(&index), sizeof(index));
+		writeTransform(file, v->corrected_pose);
+
+		Measurement::Ptr m = v->measurement;
+		writeString(file, m->getRobotName());
+		writeString(file, m->getSensorName());
+		boost::uuids::uuid uuid = m->getUniqueId();
+		file.write(reinterpret_cast<const char*>(uuid.data), uuid.size());
+		timeval stamp = m->getTimestamp();
+		int64_t sec = stamp.tv_sec;
+		int64_t usec = stamp.tv_usec;
+		file.write(reinterpret_cast<const char*>(&sec), sizeof(sec));
+		file.write(reinterpret_cast<const char*>(&usec), sizeof(usec));
+		writeTransform(file, m->getSensorPose());
+
+		// Size-prefix the payload, so unknown measurement types can
+		// still be skipped when reading.
+		std::ostringstream payload;
+		m->serialize(payload);
+		std::string data = payload.str();
+		uint64_t payload_size = data.size();
+		file.write(reinterpret_cast<const char*>(&payload_size), sizeof(payload_size));
+		file.write(data.data(), data.size());
+	}
+
+	// Write all edges with their typed constraint
+	EdgeObjectList edges = getEdgesFromSensor("");
+	uint32_t edge_count = edges.size();
+	file.write(reinterpret_cast<const char*>(&edge_count), sizeof(edge_count));
+	for(EdgeObjectList::iterator e = edges.begin(); e != edges.end(); ++e)
+	{
+		uint32_t source = e->source;
+		uint32_t target = e->target;
+		file.write(reinterpret_cast<const char*>(&source), sizeof(source));
+		file.write(reinterpret_cast<const char*>(&target), sizeof(target));
+
+		Constraint::Ptr c = e->constraint;
+		uint8_t type = c->getType();
+		file.write(reinterpret_cast<const char*>(&type), sizeof(type));
+		writeString(file, c->getSensorName());
+		switch(c->getType())
+		{
+		case SE3:
+			{
+				SE3Constraint::Ptr se3 = std::static_pointer_cast<SE3Constraint>(c);
+				writeTransform(file, se3->getRelativePose());
+				writeScalars(file, se3->getInformation().data(), 36);
+			}
+			break;
+		case GRAVITY:
+			{
+				GravityConstraint::Ptr grav = std::static_pointer_cast<GravityConstraint>(c);
+				writeScalars(file, grav->getDirection().data(), 3);
+				writeScalars(file, grav->getReference().data(), 3);
+				writeScalars(file, grav->getCovariance().data(), 4);
+			}
+			break;
+		case POSITION:
+			{
+				PositionConstraint::Ptr pos = std::static_pointer_cast<PositionConstraint>(c);
+				writeScalars(file, pos->getPosition().data(), 3);
+				writeScalars(file, pos->getCovariance().data(), 9);
+				writeTransform(file, pos->getSensorPose());
+			}
+			break;
+		case ORIENTATION:
+			{
+				OrientationConstraint::Ptr ori = std::static_pointer_cast<OrientationConstraint>(c);
+				writeScalars(file, ori->getOrientation().coeffs().data(), 4);
+				writeScalars(file, ori->getCovariance().data(), 9);
+				writeTransform(file, ori->getSensorPose());
+			}
+			break;
+		case TENTATIVE:
+			break;
+		}
+	}
+	mLogger->message(INFO, (boost::format("Saved graph with %1% vertices and %2% edges to %3%.")
+	 % vertex_count % edge_count % filename).str());
+}
+
+void Graph::load(const std::string& filename, MeasurementFactory* factory)
+{
+	std::ifstream file(filename.c_str(), std::ios::binary);
+	if(!file.is_open())
+	{
+		throw std::runtime_error((boost::format("Could not open %1% for reading.") % filename).str());
+	}
+
+	char magic[8];
+	file.read(magic, sizeof(magic));
+	uint32_t version = 0;
+	file.read(reinterpret_cast<char*>(&version), sizeof(version));
+	if(memcmp(magic, kSnapshotMagic, sizeof(magic)) != 0 || version != kSnapshotVersion)
+	{
+		throw std::runtime_error((boost::format("%1% is not a valid graph snapshot.") % filename).str());
+	}
+
+	// Read all vertices and restore their measurements via the factory
+	uint32_t vertex_count = 0;
+	file.read(reinterpret_cast<char*>(&vertex_count), sizeof(vertex_count));
+	IdType max_id = 0;
+	for(uint32_t i = 0; i < vertex_count; ++i)
+	{
+		VertexObject vo;
+		uint32_t index = 0;
+		file.read(reinterpret_cast<char*>(&index), sizeof(index));
+		vo.index = index;
+		vo.corrected_pose = readTransform(file);
+
+		std::string robot = readString(file);
+		std::string sensor = readString(file);
+		boost::uuids::uuid uuid;
+		file.read(reinterpret_cast<char*>(uuid.data), uuid.size());
+		int64_t sec = 0, usec = 0;
+		file.read(reinterpret_cast<char*>(&sec), sizeof(sec));
+		file.read(reinterpret_cast<char*>(&usec), sizeof(usec));
+		Transform sensor_pose = readTransform(file);
+
+		uint64_t payload_size = 0;
+		file.read(reinterpret_cast<char*>(&payload_size), sizeof(payload_size));
+		std::string data(payload_size, '\0');
+		file.read(&data[0], payload_size);
+
+		Measurement::Ptr m = factory->create(robot, sensor, sensor_pose, uuid);
+		timeval stamp;
+		stamp.tv_sec = sec;
+		stamp.tv_usec = usec;
+		m->setTimestamp(stamp);
+		std::istringstream payload(data);
+		m->deserialize(payload);
+		vo.measurement = m;
+
+		addVertex(vo);
+		{
+			std::lock_guard<std::mutex> guard(mUuidIndexMutex);
+			mUuidIndex.insert(UuidIndex::value_type(uuid, vo.index));
+		}
+		if(mSolver)
+		{
+			mSolver->addVertex(vo.index, vo.corrected_pose);
+			if(i == 0)
+			{
+				// Fix the first vertex to keep the map in place.
+				mSolver->setFixed(vo.index);
+			}
+		}
+		max_id = std::max(max_id, vo.index);
+	}
+	mIndexer.setNext(max_id + 1);
+	mFixNext = false;
+
+	// Read all edges and re-create their constraints
+	uint32_t edge_count = 0;
+	file.read(reinterpret_cast<char*>(&edge_count), sizeof(edge_count));
+	for(uint32_t i = 0; i < edge_count; ++i)
+	{
+		uint32_t source = 0, target = 0;
+		file.read(reinterpret_cast<char*>(&source), sizeof(source));
+		file.read(reinterpret_cast<char*>(&target), sizeof(target));
+
+		uint8_t type = 0;
+		file.read(reinterpret_cast<char*>(&type), sizeof(type));
+		std::string sensor = readString(file);
+		Constraint::Ptr c;
+		switch(static_cast<ConstraintType>(type))
+		{
+		case SE3:
+			{
+				Transform relative_pose = readTransform(file);
+				Covariance<6> information;
+				readScalars(file, information.data(), 36);
+				c = Constraint::Ptr(new SE3Constraint(sensor, relative_pose, information));
+			}
+			break;
+		case GRAVITY:
+			{
+				Direction direction, reference;
+				readScalars(file, direction.data(), 3);
+				readScalars(file, reference.data(), 3);
+				Covariance<2> covariance;
+				readScalars(file, covariance.data(), 4);
+				c = Constraint::Ptr(new GravityConstraint(sensor, direction, reference, covariance));
+			}
+			break;
+		case POSITION:
+			{
+				Position position;
+				readScalars(file, position.data(), 3);
+				Covariance<3> covariance;
+				readScalars(file, covariance.data(), 9);
+				Transform sensor_pose = readTransform(file);
+				c = Constraint::Ptr(new PositionConstraint(sensor, position, covariance, sensor_pose));
+			}
+			break;
+		case ORIENTATION:
+			{
+				Quaternion orientation;
+				readScalars(file, orientation.coeffs().data(), 4);
+				Covariance<3> covariance;
+				readScalars(file, covariance.data(), 9);
+				Transform sensor_pose = readTransform(file);
+				c = Constraint::Ptr(new OrientationConstraint(sensor, orientation, covariance, sensor_pose));
+			}
+			break;
+		case TENTATIVE:
+			c = Constraint::Ptr(new TentativeConstraint(sensor));
+			break;
+		default:
+			throw std::runtime_error((boost::format("Unknown constraint type %1% in %2%.") % (int)type % filename).str());
+		}
+		addConstraint(source, target, c);
+	}
+	mConstraintsAdded = 0;
+	mLoopClosuresAdded = 0;
+	mRebuildIndex = true;
+	mLogger->message(INFO, (boost::format("Loaded graph with %1% vertices and %2% edges from %3%.")
+	 % vertex_count % edge_count % filename).str());
 }
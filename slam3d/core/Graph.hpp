@@ -78,11 +78,19 @@ laser->addMeasurement(m);
 #include "Solver.hpp"
 
 #include <flann/flann.hpp>
+#include <boost/unordered_map.hpp>
+#include <atomic>
+#include <functional>
+#include <list>
 #include <map>
+#include <mutex>
 #include <set>
 
 namespace slam3d
 {
+	class Metrics;
+	class ThreadBudget;
+
 	typedef flann::Index< flann::L2<float> > NeighborIndex;
 	
 	/**
@@ -208,11 +216,40 @@ namespace slam3d
 		 */
 		void setSolver(Solver* solver);
 
+		/**
+		 * @brief Sets an out-of-core storage for measurement payloads.
+		 * @details Every measurement added to the graph is spilled to the
+		 * storage's backing file, so its payload can be released from
+		 * memory and restored on demand. The graph can be used without a
+		 * storage, keeping all payloads resident.
+		 * @param storage
+		 */
+		void setMeasurementStorage(MeasurementStorage* storage);
+
+		/**
+		 * @brief Draw optimization threads from a shared budget.
+		 * @details When set, optimize() occupies threads from the budget
+		 * for the duration of the solver run, so concurrent registration
+		 * work is granted fewer threads instead of oversubscribing the
+		 * machine. The budget is typically shared with the scan sensors.
+		 * @param budget shared thread budget, owned by the caller
+		 */
+		void setThreadBudget(ThreadBudget* budget);
+
+		/**
+		 * @brief Report timing of optimize() and index rebuilds.
+		 * @details The metrics object is typically shared with the Mapper
+		 * and the sensors, so all stages appear in one place.
+		 * @param metrics metrics collector, owned by the caller
+		 */
+		void setMetrics(Metrics* metrics);
+
 		/**
 		 * @brief Add a given measurement at the given pose
 		 * @details This method creates the VertexObject, adds the new vertex to
 		 * the solver, adds it to the index and then calls the method below to
-		 * actually add it to the graph.
+		 * actually add it to the graph. The pointer is taken by value and
+		 * moved into the graph, so passing an rvalue avoids a refcount bump.
 		 * @param m measurement
 		 * @param corrected initial pose for the new vertex
 		 */
@@ -250,6 +287,37 @@ namespace slam3d
 		                              IdType target,
 		                              const std::string& sensor);
 
+		/**
+		 * @brief Remove a vertex and marginalize its constraints.
+		 * @details The SE3 constraints through the removed vertex are
+		 * composed into constraints between its neighbors, so the graph
+		 * stays connected and keeps the relative pose information. The
+		 * vertex is then removed from the graph, the measurement index,
+		 * the neighbor index and the solver.
+		 * @param id
+		 * @throw InvalidVertex
+		 */
+		virtual void removeVertex(IdType id);
+
+		/**
+		 * @brief Remove redundant vertices of the given sensor.
+		 * @details A vertex is redundant when a retained vertex lies within
+		 * the given translation and rotation distance, i.e. when the pose
+		 * density is higher than needed to represent the explored area.
+		 * Redundant vertices are removed with removeVertex(), so long runs
+		 * that revisit the same places do not grow the graph without bound.
+		 * The first and the most recent vertex are always kept.
+		 * @param sensor only vertices of this sensor are considered
+		 * @param min_translation distance below which a vertex is redundant
+		 * @param min_rotation angle below which a vertex is redundant
+		 * @param max_removals limits the vertices removed per call
+		 * @return number of removed vertices
+		 */
+		unsigned sparsify(const std::string& sensor,
+		                  float min_translation,
+		                  float min_rotation,
+		                  unsigned max_removals = 100);
+
 		/**
 		 * @brief Set the corrected pose for the vertex with the given ID.
 		 * @details This method is designed to be used by Sensor and PoseSensor
@@ -260,7 +328,7 @@ namespace slam3d
 		 * @param id vertex to be changed
 		 * @param pose new corrected pose to be set
 		 */
-		void setCorrectedPose(IdType id, const Transform& pose);
+		virtual void setCorrectedPose(IdType id, const Transform& pose);
 
 		/**
 		 * @brief Start the backend optimization process.
@@ -269,7 +337,25 @@ namespace slam3d
 		 * @return true if optimization was successful
 		 */
 		virtual bool optimize(unsigned iterations = 100);
-		
+
+		/**
+		 * @brief Run the solver without touching the graph itself.
+		 * @details Unlike optimize(), this does not require the graph's
+		 * write lock, as the solver operates on its own copy of the
+		 * problem. Results are applied with applyOptimization(), so a
+		 * background thread can solve while measurements are ingested.
+		 * @param iterations maximum number of iteration steps
+		 * @return true if optimization was successful
+		 */
+		bool computeOptimization(unsigned iterations = 100);
+
+		/**
+		 * @brief Apply the corrections of the last computeOptimization().
+		 * @details Specializations take their write lock here, so the
+		 * corrected poses change atomically for all readers.
+		 */
+		virtual void applyOptimization();
+
 		/**
 		 * @brief Returns whether optimize() has been called since the last call to this.
 		 * @return true if optimization has been called
@@ -282,11 +368,46 @@ namespace slam3d
 		 */
 		unsigned getNumOfNewConstraints() { return mConstraintsAdded; }
 
+		/**
+		 * @brief Get the number of new loop closures since the last call to optimize().
+		 * @details Counts SE3 constraints between non-consecutive vertices,
+		 * which perturb the graph far more than plain odometry chains.
+		 * @return number of new loop closing constraints
+		 */
+		unsigned getNumOfNewLoopClosures() { return mLoopClosuresAdded; }
+
 		/**
 		 * @brief Causes the next added vertex to be fixed in the solver.
 		 */
 		void fixNext() { mFixNext = true; }
 
+		/**
+		 * @brief Get the current revision of the graph.
+		 * @details The revision increases monotonically whenever vertices,
+		 * constraints or corrected poses change. Consumers (e.g. map rebuilds
+		 * or cached queries) can store the revision together with their result
+		 * and compare it later to see whether that result is still current.
+		 */
+		unsigned long getRevision() const { return mRevision; }
+
+		/**
+		 * @brief Get the current revision of the vertex poses.
+		 * @details Unlike getRevision(), this only counts changes to the
+		 * corrected poses (setCorrectedPose or an optimization that moved
+		 * vertices), not purely structural changes. Caches whose validity
+		 * depends only on the poses should compare against this counter.
+		 */
+		unsigned long getPoseRevision() const { return mPoseRevision; }
+
+		/**
+		 * @brief Set the minimum pose change for corrections to be applied.
+		 * @details After optimization, only vertices whose estimate moved by
+		 * more than this threshold since their last update are rewritten in
+		 * the graph. (see Solver::getDeltaCorrections)
+		 * @param threshold
+		 */
+		void setCorrectionThreshold(ScalarType threshold) { mCorrectionThreshold = threshold; }
+
 		/**
 		 * @brief Write the current graph to a file (currently dot).
 		 * @details For larger graphs, this can take a very long time.
@@ -294,8 +415,33 @@ namespace slam3d
 		 */
 		virtual void writeGraphToFile(const std::string &name);
 
+		/**
+		 * @brief Write the graph to a compact binary snapshot file.
+		 * @details Unlike writeGraphToFile(), the snapshot can be loaded
+		 * again with load() to continue a mapping run after a restart.
+		 * Measurement payloads are included via Measurement::serialize().
+		 * @param filename
+		 */
+		void save(const std::string& filename);
+
+		/**
+		 * @brief Restore the graph from a binary snapshot file.
+		 * @details Must be called on an empty graph. Measurements are
+		 * recreated through the given factory, the internal indices are
+		 * rebuilt and all vertices and constraints are re-fed to the
+		 * solver, with the first vertex fixed to hold the map in place.
+		 * @param filename
+		 * @param factory creates the sensor-specific measurement types
+		 */
+		void load(const std::string& filename, MeasurementFactory* factory);
+
 		/**
 		 * @brief Create the index for nearest neighbor search of nodes.
+		 * @details The index is maintained incrementally: if it has been built
+		 * before for the same set of sensors, only vertices that were added
+		 * since the last call are inserted into the existing index. A full
+		 * rebuild is done on the first call, when the sensor set changes or
+		 * after optimize() has moved the indexed poses.
 		 * @param sensors index nodes of these sensors
 		 */
 		void buildNeighborIndex(const std::set<std::string>& sensors);
@@ -363,12 +509,29 @@ namespace slam3d
 		 */
 		virtual EdgeObjectList getOutEdges(IdType source) const = 0;
 
+		/**
+		 * @brief Gets a list of all vertices in the graph.
+		 */
+		virtual VertexObjectList getAllVertices() const = 0;
+
 		/**
 		 * @brief Gets a list of all vertices from given sensor.
 		 * @param sensor
 		 */
 		virtual VertexObjectList getVerticesFromSensor(const std::string& sensor) const = 0;
 
+		/**
+		 * @brief Applies the given function to each vertex from given sensor.
+		 * @details Unlike getVerticesFromSensor(), this does not copy the
+		 * VertexObjects (with their labels and measurement pointers) into a
+		 * list, so it should be preferred on hot paths that only read them.
+		 * The function must not call back into the graph.
+		 * @param sensor
+		 * @param func
+		 */
+		virtual void forEachVertexFromSensor(const std::string& sensor,
+		                                     const std::function<void(const VertexObject&)>& func) const = 0;
+
 		/**
 		 * @brief Serch for nodes by using breadth-first-search
 		 * @param source start search from this node
@@ -398,6 +561,21 @@ namespace slam3d
 		 */
 		virtual float calculateGraphDistance(IdType source, IdType target) = 0;
 
+		/**
+		 * @brief Calculates graph distances from source to many targets at once.
+		 * @details The traversal stops once all vertices within maxDistance are
+		 * settled, so querying several loop-closure candidates costs a single
+		 * bounded search instead of one full search per candidate. Targets that
+		 * are further away than maxDistance are not contained in the result.
+		 * @param source
+		 * @param targets
+		 * @param maxDistance
+		 * @throw InvalidVertex
+		 */
+		virtual std::map<IdType, float> calculateGraphDistances(IdType source,
+		                                                        const std::vector<IdType>& targets,
+		                                                        float maxDistance);
+
 	protected:
 		// Graph access
 		/**
@@ -417,13 +595,22 @@ namespace slam3d
 		virtual void addEdge(const EdgeObject& e) = 0;
 
 		/**
-		 * @brief 
+		 * @brief
 		 * @param source
 		 * @param target
 		 * @param sensor
 		 */
 		virtual void removeEdge(IdType source, IdType target, const std::string& sensor) = 0;
 
+		/**
+		 * @brief Remove the given vertex and its edges from the actual graph.
+		 * @details This method has to be implemented by the specification class.
+		 * It should not be used directly, use removeVertex() instead.
+		 * @param id
+		 * @throw InvalidVertex
+		 */
+		virtual void removeVertexInternal(IdType id) = 0;
+
 		/**
 		 * @brief Get a writable reference to a VertexObject.
 		 * @param id
@@ -446,27 +633,60 @@ namespace slam3d
 		 */
 		virtual void addToSolver(const EdgeObject& eo);
 
+		/**
+		 * @brief Write the solver's corrections into the graph.
+		 * @details Expects the graph's write lock to be held by the caller,
+		 * either via optimize() or via applyOptimization().
+		 */
+		void applyCorrections();
+
 	protected:
 		Solver* mSolver;
 		Logger* mLogger;
+		MeasurementStorage* mMeasurementStorage;
+		ThreadBudget* mThreadBudget;
+		Metrics* mMetrics;
 
 		Indexer mIndexer;
 
-		// Index to find Vertices by the unique id of their measurement
-		typedef std::map<boost::uuids::uuid, IdType> UuidIndex;
+		// Index to find Vertices by the unique id of their measurement.
+		// The mutex guards it separately from the graph lock, because
+		// insertions happen on the ingestion path while multi-robot
+		// handlers look up foreign measurements concurrently.
+		typedef boost::unordered_map<boost::uuids::uuid, IdType, boost::hash<boost::uuids::uuid> > UuidIndex;
+		mutable std::mutex mUuidIndexMutex;
 		UuidIndex mUuidIndex;
 
 		// Index to use nearest neighbor search
-		// Whenever this index is created, we have to enumerate all vertices from 0 to n-1.
+		// Whenever a vertex is added to this index, it is enumerated with the next free row.
 		// This mapping is kept in a separate map to later apply the result to the graph.
+		// The point data is kept alive in mNeighborPoints, because flann only references it.
+		// The mutex serializes index updates and searches, as several link
+		// workers may rebuild and query the index concurrently and flann
+		// does not allow that on one index.
+		mutable std::mutex mNeighborIndexMutex;
 		flann::SearchParams mSearchParams;
 		NeighborIndex mNeighborIndex;
-		std::map<IdType, IdType> mNeighborMap; // vertex-id --> neighbor-id
+		std::map<IdType, IdType> mNeighborMap; // neighbor-id --> vertex-id
+		std::list< std::vector<float> > mNeighborPoints;
+		std::set<std::string> mIndexedSensors;
+		IdType mLastIndexedVertex;
+		bool mRebuildIndex;
+
+		// Counts every change to the graph's structure or poses.
+		// Atomic, because link workers and the patch cache poll the
+		// counters without taking the graph lock.
+		std::atomic<unsigned long> mRevision;
+
+		// Counts only changes to the corrected poses
+		std::atomic<unsigned long> mPoseRevision;
 
 		// Parameters
 		bool mFixNext;
 		bool mOptimized;
 		unsigned mConstraintsAdded;
+		unsigned mLoopClosuresAdded;
+		ScalarType mCorrectionThreshold;
 	};
 }
 
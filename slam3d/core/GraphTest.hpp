@@ -15,6 +15,62 @@ void addVertexToGraph(slam3d::Graph* g, slam3d::IdType exp_id, const std::string
 	BOOST_CHECK_EQUAL(query_res.index, exp_id);
 }
 
+void test_graph_persistence(slam3d::Graph* source, slam3d::Graph* restored)
+{
+	slam3d::Transform pose1 = slam3d::Transform::Identity();
+	slam3d::Transform pose2 = slam3d::Transform::Identity();
+	pose2.translation() << 1.0, 0.0, 0.0;
+	slam3d::Transform pose3 = slam3d::Transform::Identity();
+	pose3.translation() << 2.0, 0.5, 0.0;
+
+	slam3d::Measurement::Ptr m1(new slam3d::Measurement("R1", "S1", slam3d::Transform::Identity()));
+	slam3d::Measurement::Ptr m2(new slam3d::Measurement("R1", "S1", slam3d::Transform::Identity()));
+	slam3d::Measurement::Ptr m3(new slam3d::Measurement("R1", "S2", slam3d::Transform::Identity()));
+	boost::uuids::uuid uuid2 = m2->getUniqueId();
+	source->addVertex(m1, pose1);
+	source->addVertex(m2, pose2);
+	source->addVertex(m3, pose3);
+
+	slam3d::Transform relative = slam3d::Transform::Identity();
+	relative.translation() << 1.0, 0.0, 0.0;
+	source->addConstraint(1, 2, slam3d::SE3Constraint::Ptr(
+		new slam3d::SE3Constraint("S1", relative, slam3d::Covariance<6>::Identity())));
+	source->addConstraint(2, 3, slam3d::SE3Constraint::Ptr(
+		new slam3d::SE3Constraint("S1", relative, slam3d::Covariance<6>::Identity())));
+	source->addConstraint(3, 1, slam3d::PositionConstraint::Ptr(
+		new slam3d::PositionConstraint("S2", slam3d::Position(2.0, 0.5, 0.0),
+		slam3d::Covariance<3>::Identity(), slam3d::Transform::Identity())));
+
+	source->save("graph_persistence.dat");
+
+	slam3d::MeasurementFactory factory;
+	restored->load("graph_persistence.dat", &factory);
+
+	// The vertices have to come back with their index, uuid and pose
+	slam3d::VertexObjectList vertices = restored->getAllVertices();
+	BOOST_CHECK_EQUAL(vertices.size(), 3);
+	slam3d::VertexObject vertex2;
+	BOOST_CHECK_NO_THROW(vertex2 = restored->getVertex(uuid2));
+	BOOST_CHECK_EQUAL(vertex2.index, 2);
+	BOOST_CHECK(vertex2.corrected_pose.isApprox(pose2));
+	BOOST_CHECK_EQUAL(vertex2.measurement->getRobotName(), "R1");
+	BOOST_CHECK_EQUAL(vertex2.measurement->getSensorName(), "S1");
+
+	// The edges have to come back with their typed constraints
+	slam3d::EdgeObject edge;
+	BOOST_CHECK_NO_THROW(edge = restored->getEdge(1, 2, "S1"));
+	BOOST_CHECK_EQUAL(edge.constraint->getType(), slam3d::SE3);
+	slam3d::SE3Constraint::Ptr se3 =
+		std::static_pointer_cast<slam3d::SE3Constraint>(edge.constraint);
+	BOOST_CHECK(se3->getRelativePose().isApprox(relative));
+	BOOST_CHECK_NO_THROW(edge = restored->getEdge(3, 1, "S2"));
+	BOOST_CHECK_EQUAL(edge.constraint->getType(), slam3d::POSITION);
+
+	// New vertices have to continue after the highest restored index
+	slam3d::Measurement::Ptr m4(new slam3d::Measurement("R1", "S1", slam3d::Transform::Identity()));
+	BOOST_CHECK_EQUAL(restored->addVertex(m4, pose3), 4);
+}
+
 void test_graph_construction(slam3d::Graph* graph)
 {
 	addVertexToGraph(graph, 1, "R1", "S1");
@@ -77,7 +77,7 @@ namespace slam3d
 		{
 			if(lvl < mLogLevel)
 				return;
-				
+
 			timeval tp = mClock.now();
 
 			boost::unique_lock<boost::mutex> guard(mLogMutex);
@@ -97,10 +97,27 @@ namespace slam3d
 				break;
 			case FATAL:
 				std::cerr << KRED << "[FATAL][" << tp.tv_sec << "." << USEC << tp.tv_usec << "] " << message << RST << std::endl;
-				break;		
+				break;
 			}
 		}
-		
+
+		/**
+		 * @brief Prints a lazily formatted message.
+		 * @details The callable is only invoked when the message passes
+		 * the log-level filter, so hot paths do not pay the formatting
+		 * cost for messages that are filtered out anyway.
+		 * @param lvl the message's log-level
+		 * @param produce callable without arguments returning the message
+		 */
+		template<typename Callable>
+		auto message(LOG_LEVEL lvl, const Callable& produce)
+			-> decltype(static_cast<std::string>(produce()), void())
+		{
+			if(lvl < mLogLevel)
+				return;
+			message(lvl, static_cast<std::string>(produce()));
+		}
+
 	protected:
 		Clock mClock;
 		LOG_LEVEL mLogLevel;
@@ -33,13 +33,29 @@ Mapper::Mapper(Graph* graph, Logger* log, const Transform& start)
 {
 	mGraph = graph;
 	mLogger = log;
+	mMetrics = NULL;
 	mLastIndex = 0;
 	mStartPose = start;
+	mMaxQueueSize = 10;
+	mDroppedMeasurements = 0;
+	mAsyncIngestion = false;
+	mIngestionBusy = false;
+	mIngestionShutdown = false;
+	mOptimizationBatch = 25;
+	mOptimizationIterations = 100;
+	mOptimizerShutdown = false;
 }
 
 Mapper::~Mapper()
 {
-	
+	stopOptimizer();
+	stopIngestion();
+}
+
+void Mapper::setMetrics(Metrics* metrics)
+{
+	mMetrics = metrics;
+	mGraph->setMetrics(metrics);
 }
 
 void Mapper::setStartPose(const Transform& start)
@@ -81,6 +97,194 @@ Transform Mapper::getCurrentPose()
 		return mStartPose;
 }
 
+void Mapper::setAsyncIngestion(bool enable, unsigned queue_size)
+{
+	mLogger->message(INFO, (boost::format("async_ingestion:        %1%") % enable).str());
+	mLogger->message(INFO, (boost::format("ingestion_queue_size:   %1%") % queue_size).str());
+	stopIngestion();
+	std::lock_guard<std::mutex> guard(mQueueMutex);
+	mAsyncIngestion = enable;
+	mMaxQueueSize = queue_size;
+	if(enable)
+	{
+		mIngestionThread = std::thread(&Mapper::ingestionLoop, this);
+	}
+}
+
+bool Mapper::queueMeasurement(const std::string& sensor, Measurement::Ptr m)
+{
+	QueuedMeasurement qm;
+	qm.sensor = sensor;
+	qm.measurement = m;
+	qm.odometry = Transform::Identity();
+	qm.hasOdometry = false;
+	return enqueueMeasurement(qm);
+}
+
+bool Mapper::queueMeasurement(const std::string& sensor, Measurement::Ptr m, const Transform& odom)
+{
+	QueuedMeasurement qm;
+	qm.sensor = sensor;
+	qm.measurement = m;
+	qm.odometry = odom;
+	qm.hasOdometry = true;
+	return enqueueMeasurement(qm);
+}
+
+bool Mapper::enqueueMeasurement(const QueuedMeasurement& qm)
+{
+	if(!mAsyncIngestion)
+	{
+		processMeasurement(qm);
+		return true;
+	}
+
+	std::lock_guard<std::mutex> guard(mQueueMutex);
+	if(mMeasurementQueue.size() >= mMaxQueueSize)
+	{
+		mDroppedMeasurements++;
+		mLogger->message(WARNING, (boost::format("Ingestion queue is full, dropped measurement from '%1%'. (%2% in total)")
+		 % qm.sensor % mDroppedMeasurements).str());
+		return false;
+	}
+	mMeasurementQueue.push_back(qm);
+	if(mMetrics)
+	{
+		mMetrics->setGauge("mapper.queue_depth", mMeasurementQueue.size());
+	}
+	mQueueCond.notify_one();
+	return true;
+}
+
+void Mapper::flushQueue()
+{
+	std::unique_lock<std::mutex> lock(mQueueMutex);
+	while(!mMeasurementQueue.empty() || mIngestionBusy)
+	{
+		mQueueDoneCond.wait(lock);
+	}
+}
+
+void Mapper::processMeasurement(const QueuedMeasurement& qm)
+{
+	SensorList::iterator s = mSensors.find(qm.sensor);
+	if(s == mSensors.end())
+	{
+		mLogger->message(ERROR, (boost::format("Cannot process measurement, sensor '%1%' is not registered!") % qm.sensor).str());
+		return;
+	}
+	if(qm.hasOdometry)
+		s->second->addMeasurement(qm.measurement, qm.odometry);
+	else
+		s->second->addMeasurement(qm.measurement);
+}
+
+void Mapper::ingestionLoop()
+{
+	std::unique_lock<std::mutex> lock(mQueueMutex);
+	while(true)
+	{
+		while(!mIngestionShutdown && mMeasurementQueue.empty())
+		{
+			mQueueCond.wait(lock);
+		}
+		if(mIngestionShutdown)
+			return;
+
+		QueuedMeasurement qm = mMeasurementQueue.front();
+		mMeasurementQueue.pop_front();
+		mIngestionBusy = true;
+		lock.unlock();
+		try
+		{
+			processMeasurement(qm);
+		}catch(std::exception &e)
+		{
+			mLogger->message(ERROR, (boost::format("Failed to process queued measurement from '%1%': %2%") % qm.sensor % e.what()).str());
+		}
+		lock.lock();
+		mIngestionBusy = false;
+		if(mMeasurementQueue.empty())
+		{
+			mQueueDoneCond.notify_all();
+		}
+	}
+}
+
+void Mapper::setBackgroundOptimization(bool enable, unsigned batch_size, unsigned iterations)
+{
+	mLogger->message(INFO, (boost::format("background_optimization: %1%") % enable).str());
+	mLogger->message(INFO, (boost::format("optimization_batch:     %1%") % batch_size).str());
+	stopOptimizer();
+	std::lock_guard<std::mutex> guard(mOptimizerMutex);
+	mOptimizationBatch = batch_size;
+	mOptimizationIterations = iterations;
+	if(enable)
+	{
+		mOptimizerThread = std::thread(&Mapper::optimizerLoop, this);
+	}
+}
+
+void Mapper::optimizerLoop()
+{
+	std::unique_lock<std::mutex> lock(mOptimizerMutex);
+	while(!mOptimizerShutdown)
+	{
+		mOptimizerCond.wait_for(lock, std::chrono::milliseconds(100));
+		if(mOptimizerShutdown)
+			return;
+
+		// A loop closure invalidates the whole trajectory behind it, so
+		// it is solved promptly; odometry chains accumulate to a batch.
+		bool loop = (mGraph->getNumOfNewLoopClosures() > 0);
+		if(!loop && mGraph->getNumOfNewConstraints() < mOptimizationBatch)
+			continue;
+		if(loop)
+			mLogger->message(DEBUG, "Optimizing promptly after new loop closure.");
+
+		// The solver works on its own copy of the problem, so graph
+		// queries stay responsive while it runs; only applying the
+		// corrections takes the graph's write lock. Ingestion can still
+		// stall, though: the solver's own mutex is held for the whole
+		// solve, and addVertex() forwards new vertices to the solver.
+		lock.unlock();
+		if(mGraph->computeOptimization(mOptimizationIterations))
+		{
+			mGraph->applyOptimization();
+		}
+		lock.lock();
+	}
+}
+
+void Mapper::stopOptimizer()
+{
+	{
+		std::lock_guard<std::mutex> guard(mOptimizerMutex);
+		mOptimizerShutdown = true;
+		mOptimizerCond.notify_all();
+	}
+	if(mOptimizerThread.joinable())
+	{
+		mOptimizerThread.join();
+	}
+	mOptimizerShutdown = false;
+}
+
+void Mapper::stopIngestion()
+{
+	{
+		std::lock_guard<std::mutex> guard(mQueueMutex);
+		mIngestionShutdown = true;
+		mMeasurementQueue.clear();
+		mQueueCond.notify_all();
+	}
+	if(mIngestionThread.joinable())
+	{
+		mIngestionThread.join();
+	}
+	mIngestionShutdown = false;
+}
+
 IdType Mapper::addMeasurement(Measurement::Ptr m)
 {
 	// Add the vertex to the pose graph
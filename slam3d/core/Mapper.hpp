@@ -29,6 +29,12 @@
 #include "Sensor.hpp"
 #include "PoseSensor.hpp"
 #include "Graph.hpp"
+#include "Metrics.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 namespace slam3d
 {
@@ -49,6 +55,21 @@ namespace slam3d
 		 * @return graph
 		 */
 		Graph* getGraph() { return mGraph; }
+
+		/**
+		 * @brief Collect timing and load statistics of the mapping stages.
+		 * @details The metrics object is forwarded to the graph, so its
+		 * stages are collected as well. Statistics are pulled via
+		 * getMetrics(), e.g. by a monitoring endpoint.
+		 * @param metrics metrics collector, owned by the caller
+		 */
+		void setMetrics(Metrics* metrics);
+
+		/**
+		 * @brief Access to the collected statistics, may return NULL.
+		 * @return metrics
+		 */
+		Metrics* getMetrics() { return mMetrics; }
 	
 		/**
 		 * @brief Register a pose sensor to create spatial constraints.
@@ -78,6 +99,68 @@ namespace slam3d
 		 */
 		IdType addMeasurement(Measurement::Ptr m);
 
+		/**
+		 * @brief Enable or disable asynchronous measurement ingestion.
+		 * @details When enabled, measurements given to queueMeasurement()
+		 * are processed by a separate ingestion thread, so the sensor
+		 * callback returns immediately instead of waiting for registration
+		 * and graph insertion. Together with the loop-closure worker pool
+		 * of ScanSensor this forms a pipeline: intake, registration and
+		 * loop closing run on different threads.
+		 * @param enable
+		 * @param queue_size maximum number of waiting measurements
+		 */
+		void setAsyncIngestion(bool enable, unsigned queue_size = 10);
+
+		/**
+		 * @brief Queue a measurement for processing by the given sensor.
+		 * @details With asynchronous ingestion the call returns immediately;
+		 * otherwise the measurement is processed inline. When the queue is
+		 * full, the measurement is rejected so the caller can react to the
+		 * backpressure (see getDroppedMeasurements).
+		 * @param sensor name of the sensor to process the measurement
+		 * @param m
+		 * @return false if the queue is full and the measurement was dropped
+		 */
+		bool queueMeasurement(const std::string& sensor, Measurement::Ptr m);
+
+		/**
+		 * @brief Queue a measurement together with an odometry pose.
+		 * @param sensor name of the sensor to process the measurement
+		 * @param m
+		 * @param odom
+		 * @return false if the queue is full and the measurement was dropped
+		 */
+		bool queueMeasurement(const std::string& sensor, Measurement::Ptr m, const Transform& odom);
+
+		/**
+		 * @brief Wait until all queued measurements have been processed.
+		 */
+		void flushQueue();
+
+		/**
+		 * @brief Enable or disable the background optimization scheduler.
+		 * @details When enabled, a separate thread watches the graph and
+		 * decides when to run the solver: a new loop closure triggers an
+		 * optimization promptly, while plain odometry chains accumulate
+		 * until batch_size constraints have been added. The solver runs
+		 * against its own copy of the problem and the corrections are
+		 * applied atomically on completion, so graph queries stay
+		 * responsive for the duration of the solve. Ingestion of new
+		 * measurements may still block on the solver's internal lock.
+		 * The application must then no longer call Graph::optimize()
+		 * itself.
+		 * @param enable
+		 * @param batch_size new constraints that trigger an optimization
+		 * @param iterations maximum number of solver iterations per run
+		 */
+		void setBackgroundOptimization(bool enable, unsigned batch_size = 25, unsigned iterations = 100);
+
+		/**
+		 * @brief Get the number of measurements dropped due to a full queue.
+		 */
+		unsigned getDroppedMeasurements() const { return mDroppedMeasurements; }
+
 		/**
 		 * @brief Add a new measurement from another robot.
 		 * @details The new measurement is added to the graph and directly
@@ -121,13 +204,79 @@ namespace slam3d
 		 */
 		virtual const VertexObject& getLastVertex() const;
 
+	protected:
+		// A measurement waiting to be processed by its sensor
+		struct QueuedMeasurement
+		{
+			std::string sensor;
+			Measurement::Ptr measurement;
+			Transform odometry;
+			bool hasOdometry;
+		};
+
+		/**
+		 * @brief Process the measurement directly or put it on the queue.
+		 * @details Shared backend of the queueMeasurement() overloads;
+		 * drops the measurement when the queue is full.
+		 * @param qm
+		 * @return false if the measurement was dropped
+		 */
+		bool enqueueMeasurement(const QueuedMeasurement& qm);
+
+		/**
+		 * @brief Hand the queued measurement to its sensor.
+		 * @param qm
+		 */
+		void processMeasurement(const QueuedMeasurement& qm);
+
+		/**
+		 * @brief Main loop of the ingestion thread.
+		 */
+		void ingestionLoop();
+
+		/**
+		 * @brief Stop the ingestion thread, discarding waiting measurements.
+		 */
+		void stopIngestion();
+
+		/**
+		 * @brief Main loop of the background optimization scheduler.
+		 */
+		void optimizerLoop();
+
+		/**
+		 * @brief Stop the background optimization scheduler.
+		 */
+		void stopOptimizer();
+
 	protected:
 		SensorList mSensors;
 		PoseSensorList mPoseSensors;
 		Logger* mLogger;
 		Graph* mGraph;
+		Metrics* mMetrics;
 		IdType mLastIndex;
 		Transform mStartPose;
+
+		// Queue between the sensor callbacks and the ingestion thread
+		std::deque<QueuedMeasurement> mMeasurementQueue;
+		std::thread mIngestionThread;
+		std::mutex mQueueMutex;
+		std::condition_variable mQueueCond;
+		std::condition_variable mQueueDoneCond;
+		unsigned mMaxQueueSize;
+		unsigned mDroppedMeasurements;
+		bool mAsyncIngestion;
+		bool mIngestionBusy;
+		bool mIngestionShutdown;
+
+		// Background optimization scheduler
+		std::thread mOptimizerThread;
+		std::mutex mOptimizerMutex;
+		std::condition_variable mOptimizerCond;
+		unsigned mOptimizationBatch;
+		unsigned mOptimizationIterations;
+		bool mOptimizerShutdown;
 	};
 }
 
@@ -0,0 +1,160 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "MeasurementSerializer.hpp"
+
+#include <boost/format.hpp>
+
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+
+using namespace slam3d;
+
+namespace
+{
+	const char kMessageMagic[8] = {'S','L','A','M','3','D','M','S'};
+	const uint8_t kMessageVersion = 1;
+
+	// Streambuf that appends everything written to a vector, so the
+	// message is built directly in the caller's buffer.
+	class VectorSink : public std::streambuf
+	{
+	public:
+		VectorSink(std::vector<char>& buffer) : mBuffer(buffer) {}
+
+	protected:
+		std::streamsize xsputn(const char* data, std::streamsize count)
+		{
+			mBuffer.insert(mBuffer.end(), data, data + count);
+			return count;
+		}
+
+		int overflow(int c)
+		{
+			if(c != EOF)
+			{
+				mBuffer.push_back(c);
+			}
+			return c;
+		}
+
+	private:
+		std::vector<char>& mBuffer;
+	};
+
+	// Read-only streambuf over a received buffer, so deserialization
+	// reads from the buffer in place.
+	class RegionBuffer : public std::streambuf
+	{
+	public:
+		RegionBuffer(const char* data, std::size_t size)
+		{
+			char* begin = const_cast<char*>(data);
+			setg(begin, begin, begin + size);
+		}
+	};
+
+	void writeString(std::ostream& out, const std::string& str)
+	{
+		uint32_t length = str.length();
+		out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+		out.write(str.data(), length);
+	}
+
+	std::string readString(std::istream& in)
+	{
+		uint32_t length = 0;
+		in.read(reinterpret_cast<char*>(&length), sizeof(length));
+		std::string str(length, '\0');
+		in.read(&str[0], length);
+		return str;
+	}
+}
+
+void MeasurementSerializer::serialize(Measurement::Ptr m, std::vector<char>& buffer)
+{
+	buffer.clear();
+	VectorSink sink(buffer);
+	std::ostream out(&sink);
+
+	out.write(kMessageMagic, sizeof(kMessageMagic));
+	out.write(reinterpret_cast<const char*>(&kMessageVersion), sizeof(kMessageVersion));
+
+	writeString(out, m->getRobotName());
+	writeString(out, m->getSensorName());
+	boost::uuids::uuid uuid = m->getUniqueId();
+	out.write(reinterpret_cast<const char*>(uuid.data), uuid.size());
+	timeval stamp = m->getTimestamp();
+	int64_t sec = stamp.tv_sec;
+	int64_t usec = stamp.tv_usec;
+	out.write(reinterpret_cast<const char*>(&sec), sizeof(sec));
+	out.write(reinterpret_cast<const char*>(&usec), sizeof(usec));
+	Transform pose = m->getSensorPose();
+	out.write(reinterpret_cast<const char*>(pose.matrix().data()), 16 * sizeof(ScalarType));
+
+	// The payload extends to the end of the message
+	m->serialize(out);
+}
+
+Measurement::Ptr MeasurementSerializer::deserialize(const char* buffer, std::size_t size,
+                                                    MeasurementFactory* factory)
+{
+	RegionBuffer region(buffer, size);
+	std::istream in(&region);
+
+	char magic[8];
+	in.read(magic, sizeof(magic));
+	uint8_t version = 0;
+	in.read(reinterpret_cast<char*>(&version), sizeof(version));
+	if(!in || memcmp(magic, kMessageMagic, sizeof(magic)) != 0 || version != kMessageVersion)
+	{
+		throw std::runtime_error("Buffer does not contain a valid measurement message.");
+	}
+
+	std::string robot = readString(in);
+	std::string sensor = readString(in);
+	boost::uuids::uuid uuid;
+	in.read(reinterpret_cast<char*>(uuid.data), uuid.size());
+	int64_t sec = 0, usec = 0;
+	in.read(reinterpret_cast<char*>(&sec), sizeof(sec));
+	in.read(reinterpret_cast<char*>(&usec), sizeof(usec));
+	Transform pose;
+	in.read(reinterpret_cast<char*>(pose.matrix().data()), 16 * sizeof(ScalarType));
+	if(!in)
+	{
+		throw std::runtime_error("Measurement message is truncated.");
+	}
+
+	Measurement::Ptr m = factory->create(robot, sensor, pose, uuid);
+	timeval stamp;
+	stamp.tv_sec = sec;
+	stamp.tv_usec = usec;
+	m->setTimestamp(stamp);
+	m->deserialize(in);
+	return m;
+}
@@ -0,0 +1,80 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM_MEASUREMENT_SERIALIZER_HPP
+#define SLAM_MEASUREMENT_SERIALIZER_HPP
+
+#include "Types.hpp"
+
+namespace slam3d
+{
+	/**
+	 * @class MeasurementSerializer
+	 * @brief Converts measurements to and from contiguous byte buffers.
+	 * @details This is the wire format for exchanging measurements between
+	 * robots, feeding Mapper::addExternalMeasurement() on the receiving
+	 * side. serialize() writes the measurement's envelope (robot, sensor,
+	 * unique id, timestamp, sensor pose) and its sensor-specific payload
+	 * directly into the caller-provided buffer, which can be handed to the
+	 * transport as-is. deserialize() reconstructs a measurement of the
+	 * correct type by streaming over the received buffer in place, so the
+	 * payload moves straight from the buffer into the measurement's own
+	 * container without intermediate copies.
+	 */
+	class MeasurementSerializer
+	{
+	public:
+		/**
+		 * @brief Write the given measurement into the given buffer.
+		 * @details The buffer is cleared first; afterwards it holds the
+		 * complete message including envelope and payload.
+		 * @param m
+		 * @param buffer
+		 */
+		static void serialize(Measurement::Ptr m, std::vector<char>& buffer);
+
+		/**
+		 * @brief Reconstruct a measurement from a received buffer.
+		 * @details The measurement is created by the given factory, so it
+		 * has the specific type registered for its sensor and its payload
+		 * is restored by the type's deserialize(). The buffer is only read
+		 * from, it can be released after the call.
+		 * @param buffer
+		 * @param size
+		 * @param factory creates the measurement type of the sensor
+		 * @throw std::runtime_error if the buffer is not a valid message
+		 */
+		static Measurement::Ptr deserialize(const char* buffer, std::size_t size,
+		                                    MeasurementFactory* factory);
+
+		static Measurement::Ptr deserialize(const std::vector<char>& buffer,
+		                                    MeasurementFactory* factory)
+		{
+			return deserialize(buffer.data(), buffer.size(), factory);
+		}
+	};
+}
+
+#endif
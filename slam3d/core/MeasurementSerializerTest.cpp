@@ -0,0 +1,85 @@
+#include "MeasurementSerializer.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+using namespace slam3d;
+
+namespace
+{
+	// Minimal measurement with a string payload, so the payload part of
+	// the wire format can be exercised without a sensor module.
+	class TextMeasurement : public Measurement
+	{
+	public:
+		typedef std::shared_ptr<TextMeasurement> Ptr;
+
+		TextMeasurement(const std::string& text, const std::string& robot,
+		                const std::string& sensor, const Transform& pose)
+		 : Measurement(robot, sensor, pose), mText(text) {}
+
+		TextMeasurement(const std::string& robot, const std::string& sensor,
+		                const Transform& pose, const boost::uuids::uuid& id)
+		 : Measurement(robot, sensor, pose, id) {}
+
+		const std::string& getText() const { return mText; }
+
+		void serialize(std::ostream& out) const override
+		{
+			out.write(mText.data(), mText.size());
+		}
+
+		void deserialize(std::istream& in) override
+		{
+			mText.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		}
+
+	private:
+		std::string mText;
+	};
+
+	class TextMeasurementFactory : public MeasurementFactory
+	{
+	public:
+		Measurement::Ptr create(const std::string& robot,
+		                        const std::string& sensor,
+		                        const Transform& pose,
+		                        const boost::uuids::uuid& id) override
+		{
+			return std::make_shared<TextMeasurement>(robot, sensor, pose, id);
+		}
+	};
+}
+
+BOOST_AUTO_TEST_CASE(measurement_serializer)
+{
+	Transform pose = Transform::Identity();
+	pose.translation() << 1.0, 2.0, 3.0;
+	TextMeasurement::Ptr original(new TextMeasurement("payload data", "R1", "S1", pose));
+	timeval stamp;
+	stamp.tv_sec = 123;
+	stamp.tv_usec = 456;
+	original->setTimestamp(stamp);
+
+	std::vector<char> buffer;
+	MeasurementSerializer::serialize(original, buffer);
+
+	// The reconstructed measurement has to carry the full envelope and
+	// the sensor-specific payload of the original
+	TextMeasurementFactory factory;
+	Measurement::Ptr m = MeasurementSerializer::deserialize(buffer, &factory);
+	TextMeasurement::Ptr restored = std::dynamic_pointer_cast<TextMeasurement>(m);
+	BOOST_REQUIRE(restored);
+	BOOST_CHECK_EQUAL(restored->getRobotName(), "R1");
+	BOOST_CHECK_EQUAL(restored->getSensorName(), "S1");
+	BOOST_CHECK(restored->getUniqueId() == original->getUniqueId());
+	BOOST_CHECK_EQUAL(restored->getTimestamp().tv_sec, 123);
+	BOOST_CHECK_EQUAL(restored->getTimestamp().tv_usec, 456);
+	BOOST_CHECK(restored->getSensorPose().isApprox(pose));
+	BOOST_CHECK_EQUAL(restored->getText(), "payload data");
+
+	// Damaged or truncated messages have to be rejected
+	std::vector<char> garbage(16, 'x');
+	BOOST_CHECK_THROW(MeasurementSerializer::deserialize(garbage, &factory), std::runtime_error);
+	std::vector<char> truncated(buffer.begin(), buffer.begin() + 20);
+	BOOST_CHECK_THROW(MeasurementSerializer::deserialize(truncated, &factory), std::runtime_error);
+}
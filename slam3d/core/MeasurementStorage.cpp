@@ -0,0 +1,201 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "MeasurementStorage.hpp"
+
+#include <boost/format.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <istream>
+#include <sstream>
+#include <streambuf>
+
+using namespace slam3d;
+
+namespace
+{
+	// Minimal read-only streambuf over a mapped region, so deserialize()
+	// reads directly from the mapping without an intermediate copy.
+	class RegionBuffer : public std::streambuf
+	{
+	public:
+		RegionBuffer(char* data, std::size_t size)
+		{
+			setg(data, data, data + size);
+		}
+	};
+}
+
+MeasurementStorage::MeasurementStorage(const std::string& filename, Logger* logger, std::size_t budget)
+ : mLogger(logger)
+{
+	mFileSize = 0;
+	mPageSize = sysconf(_SC_PAGESIZE);
+	mBudget = budget;
+	mResidentSize = 0;
+
+	mFile = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(mFile < 0)
+	{
+		mLogger->message(ERROR, (boost::format("Could not open measurement storage file '%1%'!") % filename).str());
+	}else
+	{
+		mLogger->message(INFO, (boost::format("Spilling measurements to '%1%', keeping %2% bytes resident.")
+		 % filename % budget).str());
+	}
+}
+
+MeasurementStorage::~MeasurementStorage()
+{
+	if(mFile >= 0)
+	{
+		close(mFile);
+	}
+}
+
+void MeasurementStorage::add(Measurement::Ptr m)
+{
+	if(mFile < 0)
+		return;
+
+	// Serialize outside the storage lock: serialize() takes the payload
+	// mutex, which a concurrent reader may already hold while waiting
+	// for the storage inside fetchPayload().
+	std::ostringstream payload;
+	m->serialize(payload);
+	const std::string& data = payload.str();
+
+	std::unique_lock<std::mutex> guard(mMutex);
+	boost::uuids::uuid id = m->getUniqueId();
+	EntryMap::iterator it = mEntries.find(id);
+	if(it == mEntries.end())
+	{
+		// Append the payload to the backing file
+		Entry entry;
+		entry.offset = mFileSize;
+		entry.size = data.size();
+		if(pwrite(mFile, data.data(), data.size(), entry.offset) != (ssize_t)data.size())
+		{
+			mLogger->message(ERROR, "Could not write payload to measurement storage!");
+			return;
+		}
+		mFileSize += entry.size;
+		it = mEntries.insert(EntryMap::value_type(id, entry)).first;
+	}
+
+	m->setStorage(this);
+	makeResident(m, it->second.size);
+}
+
+void MeasurementStorage::fetch(Measurement* m)
+{
+	std::unique_lock<std::mutex> guard(mMutex);
+	boost::uuids::uuid id = m->getUniqueId();
+	EntryMap::iterator it = mEntries.find(id);
+	if(it == mEntries.end())
+	{
+		mLogger->message(ERROR, "Requested measurement is not contained in the storage!");
+		return;
+	}
+
+	bool restore = !m->isPayloadResident();
+
+	// Account for the payload before it is restored: makeResident() uses
+	// the residency flag to detect double counting, so calling it after
+	// deserialize() would skip the size and let mResidentSize drift.
+	// The measurement was added before, so the resident map holds its
+	// shared pointer even while the payload is released.
+	ResidentMap::iterator res = mResidentMap.find(id);
+	if(res != mResidentMap.end())
+	{
+		makeResident(*(res->second), it->second.size);
+	}
+
+	if(restore)
+	{
+		// Map the payload's region of the backing file; the offset given
+		// to mmap has to be page aligned.
+		std::size_t aligned = it->second.offset - (it->second.offset % mPageSize);
+		std::size_t shift = it->second.offset - aligned;
+		void* region = mmap(NULL, it->second.size + shift, PROT_READ, MAP_SHARED, mFile, aligned);
+		if(region == MAP_FAILED)
+		{
+			mLogger->message(ERROR, "Could not map payload from measurement storage!");
+			return;
+		}
+
+		RegionBuffer buffer((char*)region + shift, it->second.size);
+		std::istream stream(&buffer);
+		m->deserialize(stream);
+		munmap(region, it->second.size + shift);
+	}
+}
+
+std::size_t MeasurementStorage::getResidentSize() const
+{
+	std::unique_lock<std::mutex> guard(mMutex);
+	return mResidentSize;
+}
+
+void MeasurementStorage::makeResident(Measurement::Ptr m, std::size_t size)
+{
+	boost::uuids::uuid id = m->getUniqueId();
+	ResidentMap::iterator res = mResidentMap.find(id);
+	if(res != mResidentMap.end())
+	{
+		// Already known, move it to the front of the LRU list
+		if(res->second != mResidentList.begin())
+		{
+			mResidentList.splice(mResidentList.begin(), mResidentList, res->second);
+		}
+		if(m->isPayloadResident())
+		{
+			return;
+		}
+	}else
+	{
+		mResidentList.push_front(m);
+		mResidentMap.insert(ResidentMap::value_type(id, mResidentList.begin()));
+	}
+	mResidentSize += size;
+
+	// Release least recently used payloads until the budget is satisfied;
+	// the payload just brought in is always kept.
+	ResidentList::iterator lru = mResidentList.end();
+	while(mResidentSize > mBudget && --lru != mResidentList.begin())
+	{
+		Measurement::Ptr victim = *lru;
+		if(!victim->isPayloadResident())
+			continue;
+		// Skip payloads that are checked out by an accessor right now;
+		// resetting them under a concurrent reader would be a race.
+		if(!victim->tryReleasePayload())
+			continue;
+		mResidentSize -= mEntries.at(victim->getUniqueId()).size;
+	}
+}
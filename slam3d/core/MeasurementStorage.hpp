@@ -0,0 +1,127 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM_MEASUREMENT_STORAGE_HPP
+#define SLAM_MEASUREMENT_STORAGE_HPP
+
+#include "Types.hpp"
+#include "Logger.hpp"
+
+#include <list>
+#include <map>
+#include <mutex>
+
+namespace slam3d
+{
+	/**
+	 * @class MeasurementStorage
+	 * @brief Out-of-core store for measurement payloads.
+	 * @details Measurement anticipates holding only "a pointer to the data"
+	 * while the data itself is managed elsewhere; this class implements that
+	 * management. Payloads are serialized once into a backing file, keyed by
+	 * the measurement's unique id, and read back through a memory mapping,
+	 * so only the pages of the requested payload are actually loaded.
+	 * An LRU list tracks which payloads are resident in memory; when their
+	 * accumulated size exceeds the given budget, the least recently used
+	 * payloads are released. Accessing a released payload (e.g. during
+	 * buildPatch() or getAccumulatedCloud()) transparently restores it from
+	 * the backing file, so resident memory stays bounded regardless of
+	 * mission length.
+	 */
+	class MeasurementStorage
+	{
+	public:
+		/**
+		 * @brief Creates the storage with the given backing file.
+		 * @details The file is created or truncated; its content does not
+		 * survive the storage, it is a spill area rather than a snapshot.
+		 * Use Graph::save() for persistent maps.
+		 * @param filename path of the backing file
+		 * @param logger pointer to a Logger to write messages
+		 * @param budget resident payload bytes before eviction starts
+		 */
+		MeasurementStorage(const std::string& filename, Logger* logger, std::size_t budget);
+		~MeasurementStorage();
+
+		/**
+		 * @brief Put the given measurement under storage control.
+		 * @details Serializes the payload into the backing file (unless it
+		 * is already contained) and attaches this storage to the
+		 * measurement, so a released payload can be restored on access.
+		 * May release the payloads of older measurements to stay within
+		 * the residency budget.
+		 * @param m
+		 */
+		void add(Measurement::Ptr m);
+
+		/**
+		 * @brief Makes the payload of the given measurement resident.
+		 * @details Called by Measurement when its payload is accessed.
+		 * Updates the LRU order and, if the payload has been released,
+		 * deserializes it from the memory-mapped backing file.
+		 * @param m
+		 */
+		void fetch(Measurement* m);
+
+		/**
+		 * @brief Current size of all resident payloads in bytes.
+		 * @details Sizes refer to the serialized payloads, the in-memory
+		 * representation may differ slightly.
+		 */
+		std::size_t getResidentSize() const;
+
+	private:
+		struct Entry
+		{
+			std::size_t offset;
+			std::size_t size;
+		};
+
+		typedef std::list<Measurement::Ptr> ResidentList;
+		typedef std::map<boost::uuids::uuid, Entry> EntryMap;
+		typedef std::map<boost::uuids::uuid, ResidentList::iterator> ResidentMap;
+
+		// Move the measurement to the front of the LRU list and release
+		// payloads from its tail until the budget is satisfied again.
+		// The caller must hold mMutex.
+		void makeResident(Measurement::Ptr m, std::size_t size);
+
+		Logger* mLogger;
+
+		int mFile;
+		std::size_t mFileSize;
+		std::size_t mPageSize;
+		EntryMap mEntries;
+
+		std::size_t mBudget;
+		std::size_t mResidentSize;
+		ResidentList mResidentList;
+		ResidentMap mResidentMap;
+
+		mutable std::mutex mMutex;
+	};
+}
+
+#endif
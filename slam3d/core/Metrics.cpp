@@ -0,0 +1,103 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "Metrics.hpp"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <limits>
+
+using namespace slam3d;
+
+Metrics::Stage::Stage()
+{
+	count = 0;
+	total_seconds = 0;
+	minimum = std::numeric_limits<double>::max();
+	maximum = 0;
+	for(unsigned i = 0; i < kHistogramBuckets; i++)
+	{
+		histogram[i] = 0;
+	}
+	for(unsigned i = 0; i < kRecentSamples; i++)
+	{
+		recent[i] = 0;
+	}
+}
+
+Metrics::Metrics(Logger* logger) : mLogger(logger), mEnabled(false)
+{
+}
+
+void Metrics::setEnabled(bool enable)
+{
+	mLogger->message(INFO, (boost::format("metrics_enabled:        %1%") % enable).str());
+	mEnabled.store(enable, std::memory_order_relaxed);
+}
+
+void Metrics::record(const std::string& stage, double seconds)
+{
+	if(!isEnabled())
+		return;
+
+	std::lock_guard<std::mutex> guard(mMutex);
+	Stage& s = mStages[stage];
+	s.recent[s.count % kRecentSamples] = seconds;
+	s.count++;
+	s.total_seconds += seconds;
+	s.minimum = std::min(s.minimum, seconds);
+	s.maximum = std::max(s.maximum, seconds);
+
+	// Find the power-of-two microsecond bucket for this sample
+	uint64_t usec = seconds * 1e6;
+	unsigned bucket = 0;
+	while(bucket < kHistogramBuckets - 1 && usec >= (1ull << (bucket + 1)))
+	{
+		bucket++;
+	}
+	s.histogram[bucket]++;
+}
+
+void Metrics::setGauge(const std::string& name, double value)
+{
+	if(!isEnabled())
+		return;
+
+	std::lock_guard<std::mutex> guard(mMutex);
+	mGauges[name] = value;
+}
+
+std::map<std::string, Metrics::Stage> Metrics::getStages() const
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	return mStages;
+}
+
+std::map<std::string, double> Metrics::getGauges() const
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	return mGauges;
+}
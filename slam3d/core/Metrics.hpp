@@ -0,0 +1,155 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM_METRICS_HPP
+#define SLAM_METRICS_HPP
+
+#include "Logger.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace slam3d
+{
+	/**
+	 * @class Metrics
+	 * @brief Collects timing and load statistics of the mapping stages.
+	 * @details Stages record their duration with a scoped Timer; queue
+	 * depths and similar values are reported as gauges. The collected
+	 * statistics are pulled via getStages() and getGauges(), e.g. by a
+	 * monitoring endpoint. Collection uses the monotonic steady clock
+	 * and costs a single atomic read per stage while disabled.
+	 */
+	class Metrics
+	{
+	public:
+		static const unsigned kHistogramBuckets = 20;
+		static const unsigned kRecentSamples = 32;
+
+		/**
+		 * @struct Stage
+		 * @brief Accumulated statistics of one instrumented stage.
+		 */
+		struct Stage
+		{
+			uint64_t count;
+			double total_seconds;
+			double minimum;
+			double maximum;
+
+			/// Bucket i counts samples within [2^i, 2^(i+1)) microseconds
+			uint32_t histogram[kHistogramBuckets];
+
+			/// Ring buffer of the most recent durations in seconds; the
+			/// sample with index (count-1) % kRecentSamples is the newest.
+			double recent[kRecentSamples];
+
+			Stage();
+		};
+
+		/**
+		 * @class Timer
+		 * @brief Records the lifetime of the scope it is created in.
+		 * @details Tolerates a NULL metrics pointer and disabled
+		 * collection, so call sites do not need to check themselves.
+		 */
+		class Timer
+		{
+		public:
+			Timer(Metrics* metrics, const char* stage) : mMetrics(metrics), mStage(stage)
+			{
+				if(mMetrics && mMetrics->isEnabled())
+					mStart = std::chrono::steady_clock::now();
+				else
+					mMetrics = NULL;
+			}
+
+			~Timer()
+			{
+				if(mMetrics)
+					mMetrics->record(mStage, std::chrono::duration<double>(
+						std::chrono::steady_clock::now() - mStart).count());
+			}
+
+			Timer(const Timer&) = delete;
+			Timer& operator=(const Timer&) = delete;
+
+		private:
+			Metrics* mMetrics;
+			const char* mStage;
+			std::chrono::steady_clock::time_point mStart;
+		};
+
+		Metrics(Logger* logger);
+
+		/**
+		 * @brief Enable or disable the collection of statistics.
+		 * @param enable
+		 */
+		void setEnabled(bool enable);
+
+		/**
+		 * @brief Whether statistics are currently collected.
+		 */
+		bool isEnabled() const { return mEnabled.load(std::memory_order_relaxed); }
+
+		/**
+		 * @brief Add one duration sample to the given stage.
+		 * @param stage name of the instrumented stage
+		 * @param seconds duration of the sample
+		 */
+		void record(const std::string& stage, double seconds);
+
+		/**
+		 * @brief Set the current value of a gauge, e.g. a queue depth.
+		 * @param name
+		 * @param value
+		 */
+		void setGauge(const std::string& name, double value);
+
+		/**
+		 * @brief Get a copy of all stage statistics.
+		 */
+		std::map<std::string, Stage> getStages() const;
+
+		/**
+		 * @brief Get a copy of all current gauge values.
+		 */
+		std::map<std::string, double> getGauges() const;
+
+	protected:
+		Logger* mLogger;
+		std::atomic<bool> mEnabled;
+
+		mutable std::mutex mMutex;
+		std::map<std::string, Stage> mStages;
+		std::map<std::string, double> mGauges;
+	};
+}
+
+#endif
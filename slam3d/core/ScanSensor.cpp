@@ -38,12 +38,68 @@ ScanSensor::ScanSensor(const std::string& n, Logger* l)
 	mMaxNeighorLinks = 1;
 	mMinLoopLength = 10;
 	mLinkPrevious = true;
+	mParallelLinking = false;
 	mLastTransform = Transform::Identity();
 	mLinkSensors.insert(n);
+	mNumLinkWorkers = 1;
+	mMaxLinkQueueSize = 10;
+	mActiveLinkJobs = 0;
+	mLinkShutdown = false;
+	mThreadBudget = NULL;
+	mMetrics = NULL;
 }
 
 ScanSensor::~ScanSensor()
 {
+	stopLinkWorkers();
+	for(PatchSolverState* state : mPatchSolverPool)
+	{
+		delete state->solver;
+		delete state;
+	}
+}
+
+void ScanSensor::setPatchSolverFactory(std::function<Solver*()> factory)
+{
+	std::lock_guard<std::mutex> guard(mPatchSolverStateMutex);
+	for(PatchSolverState* state : mPatchSolverPool)
+	{
+		delete state->solver;
+		delete state;
+	}
+	mPatchSolverPool.clear();
+	mPatchSolverFactory = factory;
+}
+
+ScanSensor::PatchSolverState* ScanSensor::acquirePatchSolverState()
+{
+	std::lock_guard<std::mutex> guard(mPatchSolverStateMutex);
+	if(!mPatchSolverPool.empty())
+	{
+		PatchSolverState* state = mPatchSolverPool.back();
+		mPatchSolverPool.pop_back();
+		return state;
+	}
+	PatchSolverState* state = new PatchSolverState;
+	state->solver = mPatchSolverFactory();
+	state->fixed = 0;
+	return state;
+}
+
+void ScanSensor::releasePatchSolverState(PatchSolverState* state)
+{
+	std::lock_guard<std::mutex> guard(mPatchSolverStateMutex);
+	mPatchSolverPool.push_back(state);
+}
+
+void ScanSensor::setThreadBudget(ThreadBudget* budget)
+{
+	mThreadBudget = budget;
+}
+
+void ScanSensor::setMetrics(Metrics* metrics)
+{
+	mMetrics = metrics;
 }
 
 bool ScanSensor::addMeasurement(const Measurement::Ptr& m)
@@ -51,14 +107,27 @@ bool ScanSensor::addMeasurement(const Measurement::Ptr& m)
 	if(mLastVertex == 0)
 	{
 		mLastVertex = mMapper->addMeasurement(m);
+		onVertexAdded(mLastVertex);
 		return true;
 	}
 
 	Measurement::Ptr source = mMapper->getGraph()->getVertex(mLastVertex).measurement;
+
+	// Reject stationary frames before running the expensive registration
+	if(!detectMotion(source, m))
+	{
+		mLogger->message(DEBUG, "Motion gate rejected the scan before registration.");
+		return false;
+	}
+
 	try
 	{
-		Constraint::Ptr c = createConstraint(source, m, mLastTransform, false);
-		SE3Constraint::Ptr se3 = boost::dynamic_pointer_cast<SE3Constraint>(c);
+		Constraint::Ptr c;
+		{
+			Metrics::Timer timer(mMetrics, "scan.registration");
+			c = createConstraint(source, m, mLastTransform, false);
+		}
+		SE3Constraint::Ptr se3 = std::dynamic_pointer_cast<SE3Constraint>(c);
 		if(!se3 || checkMinDistance(mLastTransform = se3->getRelativePose()))
 		{
 			IdType newVertex = mMapper->addMeasurement(m);
@@ -70,6 +139,7 @@ bool ScanSensor::addMeasurement(const Measurement::Ptr& m)
 			}
 			mMapper->getGraph()->addConstraint(mLastVertex, newVertex, c);
 			mLastVertex = newVertex;
+			onVertexAdded(mLastVertex);
 			return true;
 		}
 	}catch(std::exception &e)
@@ -85,6 +155,7 @@ bool ScanSensor::addMeasurement(const Measurement::Ptr& m, const Transform& odom
 	{
 		mLastVertex = mMapper->addMeasurement(m);
 		mLastOdometry = odom;
+		onVertexAdded(mLastVertex);
 		return true;
 	}
 	
@@ -98,11 +169,15 @@ bool ScanSensor::addMeasurement(const Measurement::Ptr& m, const Transform& odom
 		{
 			try
 			{
-				Constraint::Ptr c = createConstraint(source, m, odom_delta, false);
+				Constraint::Ptr c;
+				{
+					Metrics::Timer timer(mMetrics, "scan.registration");
+					c = createConstraint(source, m, odom_delta, false);
+				}
 				mMapper->getGraph()->addConstraint(mLastVertex, newVertex, c);
 
 				// Calculate the new pose relative from last pose
-				SE3Constraint::Ptr se3 = boost::dynamic_pointer_cast<SE3Constraint>(c);
+				SE3Constraint::Ptr se3 = std::dynamic_pointer_cast<SE3Constraint>(c);
 				if(se3)
 				{
 					const Transform& lastPose = mMapper->getGraph()->getVertex(mLastVertex).corrected_pose;
@@ -115,6 +190,7 @@ bool ScanSensor::addMeasurement(const Measurement::Ptr& m, const Transform& odom
 		}
 		mLastOdometry = odom;
 		mLastVertex = newVertex;
+		onVertexAdded(mLastVertex);
 		return true;
 	}
 	return false;
@@ -157,12 +233,14 @@ void ScanSensor::linkToNeighbors(IdType vertex)
 	if(mMaxNeighorLinks == 0)
 		return;
 
+	Metrics::Timer timer(mMetrics, "scan.link_neighbors");
 	mMapper->getGraph()->buildNeighborIndex(mLinkSensors);
 	VertexObject obj = mMapper->getGraph()->getVertex(vertex);
 	VertexObjectList neighbors = mMapper->getGraph()->getNearbyVertices(obj.corrected_pose, mNeighborRadius);
-	
-	int count = 0;
-	for(auto i = neighbors.rbegin(); i != neighbors.rend() && count < mMaxNeighorLinks; i++)
+
+	// Gather all candidates that are not already linked to this vertex
+	std::vector<IdType> candidates;
+	for(auto i = neighbors.rbegin(); i != neighbors.rend(); i++)
 	{
 		IdType index = i->index;
 		if(index == vertex) continue;
@@ -177,27 +255,208 @@ void ScanSensor::linkToNeighbors(IdType vertex)
 			mLogger->message(ERROR, e.what());
 			return;
 		}
+		candidates.push_back(index);
+	}
 
-		float dist = mMapper->getGraph()->calculateGraphDistance(index, vertex);
-		mLogger->message(DEBUG, (boost::format("Distance(%2%,%3%) in Graph is: %1%") % dist % index % vertex).str());
-		if(dist <= mPatchBuildingRange * 2 || dist < mMinLoopLength)
-			continue;
-		count++;
-		link(index, vertex);
+	// Candidates beyond this distance are linked in any case, so the
+	// traversal can stop there. They are not part of the query result.
+	float limit = std::max<float>(mPatchBuildingRange * 2, mMinLoopLength);
+	std::map<IdType, float> distances = mMapper->getGraph()->calculateGraphDistances(vertex, candidates, limit);
+
+	std::vector<IdType> sources;
+	for(auto i = candidates.begin(); i != candidates.end() && sources.size() < mMaxNeighorLinks; i++)
+	{
+		IdType index = *i;
+		std::map<IdType, float>::const_iterator d = distances.find(index);
+		if(d != distances.end())
+		{
+			mLogger->message(DEBUG, (boost::format("Distance(%2%,%3%) in Graph is: %1%") % d->second % index % vertex).str());
+			if(d->second <= mPatchBuildingRange * 2 || d->second < mMinLoopLength)
+				continue;
+		}
+		sources.push_back(index);
+	}
+
+	if(mParallelLinking && sources.size() > 1)
+	{
+		linkBatch(sources, vertex);
+	}else
+	{
+		for(IdType source : sources)
+		{
+			link(source, vertex);
+		}
 	}
 }
 
+void ScanSensor::linkBatch(const std::vector<IdType>& sources, IdType target)
+{
+	// Add all placeholders before starting the computation
+	for(IdType source : sources)
+	{
+		mMapper->getGraph()->addTentativeConstraint(source, target, mName);
+	}
+
+	// The target patch is shared by all registrations, build it only once
+	Measurement::Ptr target_m = buildPatch(target);
+
+	// Evaluate the candidates' registrations concurrently
+	std::vector<Constraint::Ptr> results(sources.size());
+	std::vector<std::thread> threads;
+	for(std::size_t i = 0; i < sources.size(); i++)
+	{
+		threads.push_back(std::thread([this, &sources, &results, &target_m, target, i]()
+		{
+			IdType source = sources[i];
+			try
+			{
+				Measurement::Ptr source_m = buildPatch(source);
+				Transform guess = mMapper->getGraph()->getTransform(source, target);
+				results[i] = createConstraint(source_m, target_m, guess, true);
+			}catch(NoMatch &e)
+			{
+				mLogger->message(WARNING, (boost::format("Failed to link vertex %1% and %2%, because %3%.") % source % target % e.what()).str());
+			}catch(std::exception &e)
+			{
+				mLogger->message(ERROR, (boost::format("Could not evaluate candidate %1%: %2%") % source % e.what()).str());
+			}
+		}));
+	}
+	for(auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	// Commit the successful constraints together and discard the rest
+	for(std::size_t i = 0; i < sources.size(); i++)
+	{
+		if(results[i])
+			mMapper->getGraph()->replaceConstraint(sources[i], target, results[i]);
+		else
+			mMapper->getGraph()->removeConstraint(sources[i], target, mName);
+	}
+}
+
+void ScanSensor::setParallelLinking(bool p)
+{
+	mLogger->message(INFO, (boost::format("parallel_linking:       %1%") % p).str());
+	mParallelLinking = p;
+}
+
 void ScanSensor::linkLastToNeighbors(bool mt)
 {
 	if(mMaxNeighorLinks < 1)
 		return;
 
 	if(mt)
-		boost::thread linkThread(&ScanSensor::linkToNeighbors, this, mLastVertex);
+		queueLinkJob(mLastVertex);
 	else
 		linkToNeighbors(mLastVertex);
 }
 
+void ScanSensor::queueLinkJob(IdType vertex)
+{
+	std::lock_guard<std::mutex> guard(mLinkQueueMutex);
+
+	// Start the workers on first use
+	if(mLinkWorkers.empty())
+	{
+		for(unsigned i = 0; i < mNumLinkWorkers; i++)
+		{
+			mLinkWorkers.push_back(std::thread(&ScanSensor::linkWorkerLoop, this));
+		}
+	}
+
+	// Ignore jobs that are already waiting
+	for(IdType id : mLinkQueue)
+	{
+		if(id == vertex)
+			return;
+	}
+	mLinkQueue.push_back(vertex);
+
+	// Keep the queue bounded by dropping the oldest jobs; their vertices
+	// will be reached again by newer scans of the same region.
+	while(mLinkQueue.size() > mMaxLinkQueueSize)
+	{
+		mLogger->message(WARNING, (boost::format("Dropping superseded link job for vertex %1%.") % mLinkQueue.front()).str());
+		mLinkQueue.pop_front();
+	}
+	if(mMetrics)
+	{
+		mMetrics->setGauge("scan.link_queue_depth", mLinkQueue.size());
+	}
+	mLinkQueueCond.notify_one();
+}
+
+void ScanSensor::linkWorkerLoop()
+{
+	std::unique_lock<std::mutex> lock(mLinkQueueMutex);
+	while(true)
+	{
+		while(!mLinkShutdown && mLinkQueue.empty())
+		{
+			mLinkQueueCond.wait(lock);
+		}
+		if(mLinkShutdown)
+			return;
+
+		// Serve the newest job first, it is closest to the robot's
+		// current position and most valuable for localization.
+		IdType vertex = mLinkQueue.back();
+		mLinkQueue.pop_back();
+		mActiveLinkJobs++;
+		lock.unlock();
+		try
+		{
+			linkToNeighbors(vertex);
+		}catch(std::exception &e)
+		{
+			mLogger->message(ERROR, (boost::format("Link job for vertex %1% failed: %2%") % vertex % e.what()).str());
+		}
+		lock.lock();
+		mActiveLinkJobs--;
+		if(mLinkQueue.empty() && mActiveLinkJobs == 0)
+		{
+			mLinkDoneCond.notify_all();
+		}
+	}
+}
+
+void ScanSensor::flushLinkQueue()
+{
+	std::unique_lock<std::mutex> lock(mLinkQueueMutex);
+	while(!mLinkQueue.empty() || mActiveLinkJobs > 0)
+	{
+		mLinkDoneCond.wait(lock);
+	}
+}
+
+void ScanSensor::stopLinkWorkers()
+{
+	{
+		std::lock_guard<std::mutex> guard(mLinkQueueMutex);
+		mLinkShutdown = true;
+		mLinkQueue.clear();
+		mLinkQueueCond.notify_all();
+	}
+	for(auto& worker : mLinkWorkers)
+	{
+		worker.join();
+	}
+	mLinkWorkers.clear();
+	mLinkShutdown = false;
+}
+
+void ScanSensor::setLinkWorkers(unsigned threads, unsigned queue)
+{
+	mLogger->message(INFO, (boost::format("link_workers:           %1%") % threads).str());
+	mLogger->message(INFO, (boost::format("link_queue_size:        %1%") % queue).str());
+	stopLinkWorkers();
+	mNumLinkWorkers = threads;
+	mMaxLinkQueueSize = queue;
+}
+
 Measurement::Ptr ScanSensor::buildPatch(IdType source)
 {
 	if(mPatchBuildingRange == 0)
@@ -205,10 +464,36 @@ Measurement::Ptr ScanSensor::buildPatch(IdType source)
 		return mMapper->getGraph()->getVertex(source).measurement;
 	}
 
+	Metrics::Timer timer(mMetrics, "scan.build_patch");
+
+	// Reuse a cached patch if the poses have not changed since it was built
+	unsigned long revision = mMapper->getGraph()->getPoseRevision();
+	{
+		std::lock_guard<std::mutex> guard(mPatchCacheMutex);
+		std::map<IdType, PatchCacheEntry>::iterator hit = mPatchCache.find(source);
+		if(hit != mPatchCache.end() &&
+		   hit->second.poseRevision == revision &&
+		   hit->second.range == mPatchBuildingRange)
+		{
+			mLogger->message(DEBUG, (boost::format("Reusing cached patch for vertex %1%.") % source).str());
+			return hit->second.patch;
+		}
+	}
+
 	VertexObjectList v_objects = mMapper->getGraph()->getVerticesInRange(source, mPatchBuildingRange);
 	mLogger->message(DEBUG, (boost::format("Building pointcloud patch from %1% nodes.") % v_objects.size()).str());
-	
-	if(mPatchSolver)
+
+	// The patch is accumulated relative to this pose. The cold path uses
+	// the source pose from the graph, which the shared solver is anchored
+	// to. Warm-started solvers keep their own anchor, so the relaxed
+	// source pose is used instead; the patch itself is identical.
+	Transform origin = mMapper->getGraph()->getVertex(source).corrected_pose;
+
+	if(mPatchSolverFactory)
+	{
+		origin = solvePatchWarm(v_objects, source);
+	}
+	else if(mPatchSolver)
 	{
 		std::lock_guard<std::mutex> guard(mPatchSolverMutex);
 		mPatchSolver->clear();
@@ -252,7 +537,154 @@ Measurement::Ptr ScanSensor::buildPatch(IdType source)
 			}
 		}
 	}
-	return createCombinedMeasurement(v_objects, mMapper->getGraph()->getVertex(source).corrected_pose);
+	Measurement::Ptr patch = createCombinedMeasurement(v_objects, origin);
+
+	// Cache the result; outdated entries are removed along the way,
+	// so the cache only holds patches of the current revision.
+	std::lock_guard<std::mutex> guard(mPatchCacheMutex);
+	for(std::map<IdType, PatchCacheEntry>::iterator it = mPatchCache.begin(); it != mPatchCache.end();)
+	{
+		if(it->second.poseRevision != revision)
+			it = mPatchCache.erase(it);
+		else
+			++it;
+	}
+	PatchCacheEntry entry;
+	entry.patch = patch;
+	entry.poseRevision = revision;
+	entry.range = mPatchBuildingRange;
+	mPatchCache[source] = entry;
+	return patch;
+}
+
+Transform ScanSensor::solvePatchWarm(VertexObjectList& v_objects, IdType source)
+{
+	// Check a solver state out of the pool; it is used without the lock,
+	// as it belongs to this solve exclusively until it is released.
+	PatchSolverState* state = acquirePatchSolverState();
+
+	// Returns the state to the pool on every exit path
+	struct PoolGuard
+	{
+		ScanSensor* sensor;
+		PatchSolverState* state;
+		~PoolGuard() { sensor->releasePatchSolverState(state); }
+	} pool_guard{this, state};
+
+	std::set<IdType> needed;
+	for(VertexObjectList::iterator v = v_objects.begin(); v < v_objects.end(); v++)
+	{
+		needed.insert(v->index);
+	}
+
+	// Removes a vertex from the warm solver state, together with the
+	// edges that reference it
+	auto evict = [&](IdType id)
+	{
+		if(state->vertices.erase(id) == 0)
+			return;
+		state->solver->removeVertex(id);
+		if(state->fixed == id)
+		{
+			state->fixed = 0;
+		}
+		for(auto e = state->edges.begin(); e != state->edges.end();)
+		{
+			if(std::get<0>(e->first) == id || std::get<1>(e->first) == id)
+				e = state->edges.erase(e);
+			else
+				++e;
+		}
+	};
+
+	// Drop vertices that left the neighborhood since the last solve
+	for(std::set<IdType>::iterator it = state->vertices.begin(); it != state->vertices.end();)
+	{
+		IdType id = *it;
+		++it;
+		if(needed.find(id) == needed.end())
+		{
+			evict(id);
+		}
+	}
+
+	// A replaced constraint (e.g. a tentative edge turned into a real
+	// registration result) keeps its endpoints and sensor; evict both
+	// endpoints, so the edge is re-added with the new values instead of
+	// solving with the stale ones.
+	EdgeObjectList e_objects = mMapper->getGraph()->getEdges(v_objects);
+	for(EdgeObjectList::iterator e = e_objects.begin(); e < e_objects.end(); e++)
+	{
+		if(e->constraint->getType() != SE3)
+			continue;
+		PatchEdgeKey key(e->source, e->target, e->constraint->getSensorId());
+		std::map<PatchEdgeKey, Constraint::Ptr>::iterator it = state->edges.find(key);
+		if(it != state->edges.end() && it->second != e->constraint)
+		{
+			evict(e->source);
+			evict(e->target);
+		}
+	}
+
+	// Add what is new since the last solve; retained vertices keep their
+	// relaxed poses as initialization
+	for(VertexObjectList::iterator v = v_objects.begin(); v < v_objects.end(); v++)
+	{
+		if(state->vertices.find(v->index) == state->vertices.end())
+		{
+			state->solver->addVertex(v->index, v->corrected_pose);
+			state->vertices.insert(v->index);
+		}
+	}
+
+	for(EdgeObjectList::iterator e = e_objects.begin(); e < e_objects.end(); e++)
+	{
+		if(e->constraint->getType() != SE3)
+			continue;
+		PatchEdgeKey key(e->source, e->target, e->constraint->getSensorId());
+		if(state->edges.find(key) != state->edges.end())
+			continue;
+		try
+		{
+			state->solver->addEdge(e->source, e->target, e->constraint);
+			state->edges[key] = e->constraint;
+		}catch(Solver::BadEdge &be)
+		{
+			mLogger->message(ERROR, be.what());
+		}
+	}
+
+	// Exactly one vertex anchors the patch. Which one does not matter,
+	// as the result is used relative to the source pose, so the anchor
+	// is only replaced when it has left the neighborhood.
+	if(state->fixed == 0)
+	{
+		state->solver->setFixed(source);
+		state->fixed = source;
+	}
+
+	state->solver->compute();
+	IdPoseVector res = state->solver->getCorrections();
+	for(IdPoseVector::iterator it = res.begin(); it < res.end(); it++)
+	{
+		for(VertexObjectList::iterator v = v_objects.begin(); v < v_objects.end(); v++)
+		{
+			if(v->index == it->first)
+			{
+				v->corrected_pose = it->second;
+				break;
+			}
+		}
+	}
+
+	for(VertexObjectList::iterator v = v_objects.begin(); v < v_objects.end(); v++)
+	{
+		if(v->index == source)
+		{
+			return v->corrected_pose;
+		}
+	}
+	return mMapper->getGraph()->getVertex(source).corrected_pose;
 }
 
 void ScanSensor::setNeighborRadius(float r, unsigned l)
@@ -26,10 +26,19 @@
 #ifndef SLAM3D_SCANSENSOR_HPP
 #define SLAM3D_SCANSENSOR_HPP
 
+#include "Metrics.hpp"
 #include "Sensor.hpp"
 #include "Solver.hpp"
+#include "ThreadBudget.hpp"
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <mutex>
+#include <set>
+#include <thread>
+#include <tuple>
+#include <vector>
 
 namespace slam3d
 {
@@ -48,6 +57,42 @@ namespace slam3d
 		 */
 		void setPatchSolver(Solver* solver) { mPatchSolver = solver; }
 
+		/**
+		 * @brief Provide a factory creating pooled patch solvers.
+		 * @details Each patch solve checks a solver instance out of a
+		 * shared pool (creating one when the pool is empty), so
+		 * concurrent link jobs no longer serialize on the single
+		 * instance set with setPatchSolver(). The instances are
+		 * warm-started: each keeps the neighborhood of its previous
+		 * solve and is only updated with the difference, so consecutive
+		 * solves of nearly the same subgraph start from the relaxed
+		 * poses instead of solving from scratch. This requires a solver
+		 * backend that supports removeVertex(). Created instances are
+		 * owned by the sensor. When a factory is set, it takes
+		 * precedence over setPatchSolver(); call this before any link
+		 * workers are started.
+		 * @param factory creates a fresh solver instance on demand
+		 */
+		void setPatchSolverFactory(std::function<Solver*()> factory);
+
+		/**
+		 * @brief Draw registration threads from a shared budget.
+		 * @details When set, each registration acquires its threads from
+		 * the budget before it starts, so concurrent sequential matches,
+		 * loop closures and optimization cycles no longer oversubscribe
+		 * the machine. The budget is typically shared with the Graph.
+		 * @param budget shared thread budget, owned by the caller
+		 */
+		void setThreadBudget(ThreadBudget* budget);
+
+		/**
+		 * @brief Report timing of registration, patch building and linking.
+		 * @details The metrics object is typically shared with the Graph
+		 * and the Mapper, so all stages appear in one place.
+		 * @param metrics metrics collector, owned by the caller
+		 */
+		void setMetrics(Metrics* metrics);
+
 		/**
 		 * @brief Set how far to continue with a breadth-first-search through
 		 * the pose graph when building local map patches to match new
@@ -103,7 +148,12 @@ namespace slam3d
 		 * @brief Build a local map patch starting from the given source vertex.
 		 * @param source
 		 */
-		Measurement::Ptr buildPatch(IdType source);
+		virtual Measurement::Ptr buildPatch(IdType source);
+
+		/**
+		 * @brief Get the range used for building local map patches.
+		 */
+		unsigned getPatchBuildingRange() const { return mPatchBuildingRange; }
 
 		/**
 		 * @brief Create a constraint between two measurements.
@@ -140,27 +190,176 @@ namespace slam3d
 		 * @param vertex
 		 */
 		void linkToNeighbors(IdType vertex);
+
+		/**
+		 * @brief Sets whether neighbor candidates are evaluated in parallel.
+		 * @details In parallel mode, linkToNeighbors() builds the shared
+		 * patch of the new vertex once, runs the candidates' registrations
+		 * concurrently and commits the successful constraints together,
+		 * instead of one full registration pipeline after the other.
+		 * @param p
+		 */
+		void setParallelLinking(bool p);
 		
 		/**
 		 * @brief Create connecting edges for last added vertex.
-		 * @param mt whether to run in a separate thread
+		 * @param mt whether to run on the loop-closure worker pool
 		 */
 		void linkLastToNeighbors(bool mt = false);
 
+		/**
+		 * @brief Configure the worker pool for loop-closure jobs.
+		 * @details Jobs queued by linkLastToNeighbors(true) are processed by
+		 * this fixed number of threads instead of one detached thread per
+		 * scan. When more jobs arrive than fit into the queue, the oldest
+		 * ones are dropped, as they are superseded by newer scans.
+		 * Already running workers are joined before the change.
+		 * @param threads number of worker threads
+		 * @param queue maximum number of waiting jobs
+		 */
+		void setLinkWorkers(unsigned threads, unsigned queue = 10);
+
+		/**
+		 * @brief Wait until all queued loop-closure jobs have finished.
+		 */
+		void flushLinkQueue();
+
 		/**
 		 * @brief Returns the current pose from sequential scan matching.
 		 */
 		Transform getCurrentPose() const;
 
+	protected:
+		/**
+		 * @brief Called after a new vertex of this sensor has been created.
+		 * @details Allows specific sensors to maintain incremental structures
+		 * for the active region, e.g. a rolling patch of the newest scans.
+		 * @param vertex
+		 */
+		virtual void onVertexAdded(IdType vertex) {}
+
+		/**
+		 * @brief Cheap estimate whether the robot moved between two scans.
+		 * @details Called before the full registration when no odometry is
+		 * available, so stationary frames can be rejected without running
+		 * createConstraint() on them. Implementations should be much
+		 * cheaper than an actual registration; when in doubt they must
+		 * return true, the exact decision is made by checkMinDistance()
+		 * after the registration. The default accepts every scan.
+		 * @param source the last added measurement
+		 * @param target the new measurement
+		 */
+		virtual bool detectMotion(const Measurement::Ptr& source, const Measurement::Ptr& target) { return true; }
+
+	protected:
+		// Shared thread budget for registration work, may be NULL
+		ThreadBudget* mThreadBudget;
+
+		// Shared metrics collector, may be NULL
+		Metrics* mMetrics;
+
+	private:
+		/**
+		 * @brief Link all sources to the target, evaluating them in parallel.
+		 * @param sources
+		 * @param target
+		 */
+		void linkBatch(const std::vector<IdType>& sources, IdType target);
+
+		/**
+		 * @brief Put a loop-closure job for the given vertex into the queue.
+		 * @param vertex
+		 */
+		void queueLinkJob(IdType vertex);
+
+		/**
+		 * @brief Main loop of the loop-closure workers.
+		 */
+		void linkWorkerLoop();
+
+		/**
+		 * @brief Stop all workers, discarding jobs that have not started yet.
+		 */
+		void stopLinkWorkers();
+
+	private:
+		/**
+		 * @brief Relax the patch with this thread's warm-started solver.
+		 * @details Updates the solver state with the difference to the
+		 * previously solved neighborhood and writes the relaxed poses
+		 * back into the given list.
+		 * @param v_objects vertices of the patch, poses are updated
+		 * @param source vertex the patch is built around
+		 * @return the relaxed pose of the source vertex
+		 */
+		Transform solvePatchWarm(VertexObjectList& v_objects, IdType source);
+
 	private:
 		Solver* mPatchSolver;
 		std::mutex mPatchSolverMutex;
 
+		// Warm-started solver state together with the neighborhood it
+		// currently holds. Edges are keyed by endpoints and sensor, as
+		// constraint addresses are recycled by the pooled allocator;
+		// the stored pointer keeps the constraint alive and detects
+		// when replaceConstraint() has swapped it for a new one.
+		typedef std::tuple<IdType, IdType, SensorId> PatchEdgeKey;
+		struct PatchSolverState
+		{
+			Solver* solver;
+			std::set<IdType> vertices;
+			std::map<PatchEdgeKey, Constraint::Ptr> edges;
+			IdType fixed;
+		};
+
+		/**
+		 * @brief Check an idle solver state out of the pool.
+		 * @details Creates a new state when the pool is empty; the most
+		 * recently released state is handed out first, as it is the
+		 * most likely to overlap with the requested neighborhood.
+		 */
+		PatchSolverState* acquirePatchSolverState();
+
+		/**
+		 * @brief Return a solver state to the pool.
+		 * @param state
+		 */
+		void releasePatchSolverState(PatchSolverState* state);
+
+		std::function<Solver*()> mPatchSolverFactory;
+		std::deque<PatchSolverState*> mPatchSolverPool;
+		std::mutex mPatchSolverStateMutex;
+
+		// Cache of recently built patches, so matching one vertex against
+		// several candidates does not rebuild the same patch each time.
+		// An entry is valid as long as the poses and the building range
+		// that it was created with are still current.
+		struct PatchCacheEntry
+		{
+			Measurement::Ptr patch;
+			unsigned long poseRevision;
+			unsigned range;
+		};
+		std::map<IdType, PatchCacheEntry> mPatchCache;
+		std::mutex mPatchCacheMutex;
+
+		// Worker pool for loop-closure jobs, newest jobs are served first
+		std::deque<IdType> mLinkQueue;
+		std::vector<std::thread> mLinkWorkers;
+		std::mutex mLinkQueueMutex;
+		std::condition_variable mLinkQueueCond;
+		std::condition_variable mLinkDoneCond;
+		unsigned mNumLinkWorkers;
+		unsigned mMaxLinkQueueSize;
+		unsigned mActiveLinkJobs;
+		bool mLinkShutdown;
+
 		unsigned mPatchBuildingRange;
 		unsigned mMaxNeighorLinks;
 		float mNeighborRadius;
 		unsigned mMinLoopLength;
 		bool mLinkPrevious;
+		bool mParallelLinking;
 
 		Transform mLastOdometry;
 		Transform mLastTransform;
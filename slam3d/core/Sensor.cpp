@@ -30,6 +30,18 @@
 
 using namespace slam3d;
 
+bool Sensor::addMeasurement(const Measurement::Ptr& m)
+{
+	mLogger->message(ERROR, (boost::format("Sensor '%1%' does not implement addMeasurement()!") % mName).str());
+	return false;
+}
+
+bool Sensor::addMeasurement(const Measurement::Ptr& m, const Transform& odom)
+{
+	mLogger->message(ERROR, (boost::format("Sensor '%1%' does not implement addMeasurement() with odometry!") % mName).str());
+	return false;
+}
+
 bool Sensor::checkMinDistance(const Transform &t)
 {
 	ScalarType rot = Eigen::AngleAxis<ScalarType>(t.rotation()).angle();
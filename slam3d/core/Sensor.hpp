@@ -101,6 +101,25 @@ namespace slam3d
 		 */
 		std::string getName() const { return mName; }
 		
+		/**
+		 * @brief Add a new measurement from this sensor.
+		 * @details Specific sensors have to implement this to process the
+		 * measurement and add it to the graph. It is called by the Mapper
+		 * when measurements are ingested through its queue. The base
+		 * implementation only reports an error.
+		 * @param m
+		 * @return whether a new vertex was created
+		 */
+		virtual bool addMeasurement(const Measurement::Ptr& m);
+
+		/**
+		 * @brief Add a new measurement together with an odometry pose.
+		 * @param m
+		 * @param odom
+		 * @return whether a new vertex was created
+		 */
+		virtual bool addMeasurement(const Measurement::Ptr& m, const Transform& odom);
+
 		/**
 		 * @brief Set minimal change in pose between adjacent nodes.
 		 * @param t Minimum translation between nodes (in meter).
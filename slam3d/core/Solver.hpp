@@ -29,6 +29,9 @@
 #include "Types.hpp"
 #include "Logger.hpp"
 
+#include <boost/format.hpp>
+
+#include <map>
 #include <vector>
 
 namespace slam3d
@@ -140,16 +143,16 @@ namespace slam3d
 			switch(c->getType())
 			{
 			case SE3:
-				addEdgeSE3(source, target, boost::static_pointer_cast<SE3Constraint>(c));
+				addEdgeSE3(source, target, std::static_pointer_cast<SE3Constraint>(c));
 				break;
 			case GRAVITY:
-				addEdgeGravity(source, boost::static_pointer_cast<GravityConstraint>(c));
+				addEdgeGravity(source, std::static_pointer_cast<GravityConstraint>(c));
 				break;
 			case POSITION:
-				addEdgePosition(source, boost::static_pointer_cast<PositionConstraint>(c));
+				addEdgePosition(source, std::static_pointer_cast<PositionConstraint>(c));
 				break;
 			case ORIENTATION:
-				addEdgeOrientation(source, boost::static_pointer_cast<OrientationConstraint>(c));
+				addEdgeOrientation(source, std::static_pointer_cast<OrientationConstraint>(c));
 				break;
 			default:
 				std::ostringstream msg;
@@ -189,6 +192,18 @@ namespace slam3d
 		 */
 		virtual void addEdgeOrientation(IdType vertex, OrientationConstraint::Ptr ori) = 0;
 		
+		/**
+		 * @brief Remove a vertex and its edges from the internal graph.
+		 * @details Used by graph sparsification. Backends without removal
+		 * support keep the default implementation, which only reports
+		 * an error.
+		 * @param id
+		 */
+		virtual void removeVertex(IdType id)
+		{
+			mLogger->message(ERROR, "This solver does not support vertex removal!");
+		}
+
 		/**
 		 * @brief Fix the vertex with the given id, so it is not moved during optimization.
 		 * @details At least one vertex must be fixed in order to hold the map in place.
@@ -200,7 +215,15 @@ namespace slam3d
 		 * @brief Start optimization of the defined graph.
 		 */
 		virtual bool compute(unsigned iterations = 100) = 0;
-	
+
+		/**
+		 * @brief Number of worker threads occupied by a call to compute().
+		 * @details Used by Graph to size its lease from the shared
+		 * ThreadBudget. The default of one matches solvers that run
+		 * single-threaded; parallel implementations should override this.
+		 */
+		virtual unsigned getThreadsUsed() const { return 1; }
+
 		/**
 		 * @brief Clear internal graph structure by removing all vertices and constraints.
 		 */
@@ -219,8 +242,41 @@ namespace slam3d
 		 * ID's and Transforms, that have to be applied to the vertices with the
 		 * given ID to minimize the error in the PoseGraph.
 		 */
-		virtual IdPoseVector getCorrections() = 0;
-		
+		virtual const IdPoseVector& getCorrections() = 0;
+
+		/**
+		 * @brief Get only the corrections that changed since the last retrieval.
+		 * @details After an incremental update, most vertices keep their previous
+		 * estimate. This method returns only the vertices whose pose moved by
+		 * more than the given threshold since the last call, so the Graph does
+		 * not have to rewrite every single vertex after each optimization.
+		 * The filter works on getCorrections(); implementations only have
+		 * to clear mReportedPoses together with their graph in clear().
+		 * @param threshold minimum change in translation or rotation to report a vertex
+		 */
+		virtual IdPoseVector getDeltaCorrections(ScalarType threshold)
+		{
+			const IdPoseVector& corrections = getCorrections();
+			IdPoseVector delta;
+			for(IdPoseVector::const_iterator it = corrections.begin(); it < corrections.end(); it++)
+			{
+				// Skip vertices that did not move since they were last reported
+				std::map<IdType, Transform>::iterator reported = mReportedPoses.find(it->first);
+				if(reported != mReportedPoses.end())
+				{
+					Transform diff = reported->second.inverse() * it->second;
+					ScalarType angle = Eigen::AngleAxis<ScalarType>(diff.rotation()).angle();
+					if(diff.translation().norm() <= threshold && std::abs(angle) <= threshold)
+						continue;
+				}
+				mReportedPoses[it->first] = it->second;
+				delta.push_back(*it);
+			}
+			mLogger->message(DEBUG, (boost::format("Reporting %1% of %2% corrections as delta.")
+			 % delta.size() % corrections.size()).str());
+			return delta;
+		}
+
 		/**
 		 * @brief Set the Logger to be used by the Solver.
 		 * @param log Specialized logger implementation.
@@ -229,6 +285,9 @@ namespace slam3d
 		
 	protected:
 		Logger* mLogger;
+
+		// Poses as they were last returned by getDeltaCorrections()
+		std::map<IdType, Transform> mReportedPoses;
 	};
 }
 
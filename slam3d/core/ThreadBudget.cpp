@@ -0,0 +1,84 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "ThreadBudget.hpp"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <thread>
+
+using namespace slam3d;
+
+ThreadBudget::ThreadBudget(Logger* logger, unsigned total)
+ : mLogger(logger)
+{
+	if(total == 0)
+		total = std::max(1u, std::thread::hardware_concurrency());
+	mTotal = total;
+	mLogger->message(INFO, (boost::format("thread_budget:          %1%") % mTotal).str());
+	for(unsigned i = 0; i < TASK_COUNT; i++)
+	{
+		mReservation[i] = 0;
+		mUsed[i] = 0;
+	}
+}
+
+void ThreadBudget::setReservation(ThreadTask task, unsigned threads)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	mLogger->message(INFO, (boost::format("thread_reservation[%1%]:  %2%") % task % threads).str());
+	mReservation[task] = threads;
+}
+
+unsigned ThreadBudget::acquire(ThreadTask task, unsigned desired)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+
+	// Each task occupies at least its reservation, whether it currently
+	// uses it or not, so the guaranteed shares cannot be stolen
+	unsigned committed = 0;
+	for(unsigned i = 0; i < TASK_COUNT; i++)
+	{
+		committed += std::max(mUsed[i], mReservation[i]);
+	}
+	unsigned free = mTotal > committed ? mTotal - committed : 0;
+	unsigned reserved_left = mReservation[task] > mUsed[task] ? mReservation[task] - mUsed[task] : 0;
+
+	unsigned granted = std::max(1u, std::min(desired, free + reserved_left));
+	mUsed[task] += granted;
+	return granted;
+}
+
+void ThreadBudget::release(ThreadTask task, unsigned granted)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	if(granted > mUsed[task])
+	{
+		mLogger->message(WARNING, "Released more threads than were acquired!");
+		granted = mUsed[task];
+	}
+	mUsed[task] -= granted;
+}
@@ -0,0 +1,145 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM_THREAD_BUDGET_HPP
+#define SLAM_THREAD_BUDGET_HPP
+
+#include "Logger.hpp"
+
+#include <mutex>
+
+namespace slam3d
+{
+	/**
+	 * @brief Kinds of work that draw threads from the budget.
+	 */
+	enum ThreadTask
+	{
+		TASK_MATCHING = 0,
+		TASK_LOOP_CLOSURE,
+		TASK_OPTIMIZATION,
+		TASK_COUNT
+	};
+
+	/**
+	 * @class ThreadBudget
+	 * @brief Divides the machine's cores between the concurrent subsystems.
+	 * @details The parallel registration methods, the loop-closure workers
+	 * and the solver each use as many threads as they can when run alone,
+	 * which oversubscribes the machine as soon as they overlap. A shared
+	 * budget lets every piece of work acquire a number of threads before
+	 * it starts: a task always receives its configured reservation, while
+	 * everything beyond that is handed out from whatever the others are
+	 * not using at the moment. Typically the sequential matching gets a
+	 * guaranteed share, so its latency stays flat while loop closures and
+	 * optimization split the remaining cores.
+	 */
+	class ThreadBudget
+	{
+	public:
+		/**
+		 * @brief Constructor
+		 * @param logger pointer to a Logger to write messages
+		 * @param total number of threads to divide, 0 uses all hardware threads
+		 */
+		ThreadBudget(Logger* logger, unsigned total = 0);
+
+		/**
+		 * @brief Guarantee a task a minimum number of threads.
+		 * @details The reserved threads are granted to the task even when
+		 * the machine is fully loaded; while the task is idle they are
+		 * not handed out to the others.
+		 * @param task
+		 * @param threads
+		 */
+		void setReservation(ThreadTask task, unsigned threads);
+
+		/**
+		 * @brief Draw threads from the budget before starting a piece of work.
+		 * @details Grants at most the desired number: the task's unused
+		 * reservation plus whatever is neither in use nor reserved for
+		 * the other tasks, but always at least one. Must be paired with
+		 * release(); prefer the Lease helper.
+		 * @param task
+		 * @param desired
+		 * @return number of threads granted
+		 */
+		unsigned acquire(ThreadTask task, unsigned desired);
+
+		/**
+		 * @brief Return previously acquired threads to the budget.
+		 * @param task
+		 * @param granted the value returned by acquire()
+		 */
+		void release(ThreadTask task, unsigned granted);
+
+		/**
+		 * @class Lease
+		 * @brief Scoped acquisition of threads from a budget.
+		 * @details Acquires on construction and releases on destruction.
+		 * A null budget is allowed, so call sites work unchanged when no
+		 * budget has been configured; threads() is then 0, meaning "use
+		 * the default".
+		 */
+		class Lease
+		{
+		public:
+			Lease(ThreadBudget* budget, ThreadTask task, unsigned desired)
+			: mBudget(budget), mTask(task), mThreads(0)
+			{
+				if(mBudget)
+					mThreads = mBudget->acquire(mTask, desired);
+			}
+
+			~Lease()
+			{
+				if(mBudget)
+					mBudget->release(mTask, mThreads);
+			}
+
+			Lease(const Lease&) = delete;
+			Lease& operator=(const Lease&) = delete;
+
+			/**
+			 * @brief Number of threads granted, 0 without a budget.
+			 */
+			unsigned threads() const { return mThreads; }
+
+		private:
+			ThreadBudget* mBudget;
+			ThreadTask mTask;
+			unsigned mThreads;
+		};
+
+	private:
+		Logger* mLogger;
+		unsigned mTotal;
+		unsigned mReservation[TASK_COUNT];
+		unsigned mUsed[TASK_COUNT];
+		std::mutex mMutex;
+	};
+}
+
+#endif
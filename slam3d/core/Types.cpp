@@ -1,20 +1,89 @@
 #include "Types.hpp"
+#include "MeasurementStorage.hpp"
 
+#include <boost/pool/pool.hpp>
+
+#include <new>
+#include <boost/thread/mutex.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 
 using namespace slam3d;
 
+namespace
+{
+	// Size-segregated pools for constraint objects. There are only a
+	// handful of constraint types (and therefore sizes), each pool hands
+	// out fixed-size chunks and reuses freed ones.
+	boost::mutex sPoolMutex;
+
+	std::map<std::size_t, boost::pool<>*>& constraintPools()
+	{
+		static std::map<std::size_t, boost::pool<>*> pools;
+		return pools;
+	}
+}
+
+void* Constraint::operator new(std::size_t size)
+{
+	boost::unique_lock<boost::mutex> guard(sPoolMutex);
+	boost::pool<>*& pool = constraintPools()[size];
+	if(!pool)
+	{
+		pool = new boost::pool<>(size);
+	}
+	void* p = pool->malloc();
+	if(!p)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void Constraint::operator delete(void* p, std::size_t size)
+{
+	if(!p)
+		return;
+	boost::unique_lock<boost::mutex> guard(sPoolMutex);
+	constraintPools()[size]->free(p);
+}
+
+SensorId SensorIndex::resolve(const std::string& name)
+{
+	static boost::mutex mutex;
+	static std::map<std::string, SensorId> index;
+
+	boost::unique_lock<boost::mutex> guard(mutex);
+	std::map<std::string, SensorId>::iterator it = index.find(name);
+	if(it != index.end())
+		return it->second;
+	SensorId id = index.size();
+	index.insert(std::map<std::string, SensorId>::value_type(name, id));
+	return id;
+}
+
 Measurement::Measurement(const std::string& r, const std::string& s,
                          const Transform& p, const boost::uuids::uuid id)
 {
 	mRobotName = r;
 	mSensorName = s;
+	mSensorId = SensorIndex::resolve(s);
 	mSensorPose = p;
 	mInverseSensorPose = p.inverse();
 	if(id.is_nil())
 		mUniqueId = boost::uuids::random_generator()();
 	else
 		mUniqueId = id;
+	mStorage = NULL;
+}
+
+void Measurement::fetchPayload() const
+{
+	if(mStorage)
+	{
+		// Restoring the payload does not change the observable state of
+		// the measurement, so accessors can stay const.
+		mStorage->fetch(const_cast<Measurement*>(this));
+	}
 }
 
 // Re-orthogonalize the rotation-matrix
@@ -27,10 +27,13 @@
 #define SLAM_TYPES_HPP
 
 #include <sys/time.h>
-#include <boost/shared_ptr.hpp>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <boost/uuid/nil_generator.hpp>
 #include <Eigen/Geometry>
 
+#include <iosfwd>
 #include <string>
 #include <vector>
 #include <map>
@@ -38,6 +41,7 @@
 namespace slam3d
 {
 	typedef unsigned IdType;
+	typedef unsigned SensorId;
 	typedef double ScalarType;
 	typedef Eigen::Matrix<ScalarType,3,1> Position;
 	typedef Eigen::Matrix<ScalarType,3,1> Direction;
@@ -55,16 +59,35 @@ namespace slam3d
 	/**
 	 * @class Indexer
 	 * @brief Constructor for continuous identifiers.
+	 * @details The counter is atomic, so identifiers stay unique even
+	 * when vertices are created from multiple threads.
 	 */
 	class Indexer
 	{
 	public:
 		Indexer():mNextID(1) {}
 		IdType getNext() { return mNextID++; }
+		void setNext(IdType id) { mNextID = id; }
 	private:
-		IdType mNextID;
+		std::atomic<IdType> mNextID;
 	};
 	
+	/**
+	 * @class SensorIndex
+	 * @brief Interns sensor names into small integer handles.
+	 * @details Sensor identity is carried as std::string in the public API,
+	 * but comparing strings on hot paths (e.g., edge matching) is costly.
+	 * The index resolves each name once to a unique SensorId, so identity
+	 * checks become integer compares. Resolution is thread-safe.
+	 */
+	class SensorIndex
+	{
+	public:
+		static SensorId resolve(const std::string& name);
+	};
+
+	class MeasurementStorage;
+
 	/**
 	 * @class Measurement
 	 * @brief Base class for a single reading from a sensor.
@@ -75,7 +98,7 @@ namespace slam3d
 	class Measurement
 	{
 	public:
-		typedef boost::shared_ptr<Measurement> Ptr;
+		typedef std::shared_ptr<Measurement> Ptr;
 		
 	public:
 		Measurement(const std::string& r, const std::string& s,
@@ -83,22 +106,130 @@ namespace slam3d
 		virtual ~Measurement(){}
 		
 		timeval getTimestamp() const { return mStamp; }
-		std::string getRobotName() const { return mRobotName; }
-		std::string getSensorName() const { return mSensorName; }
+		void setTimestamp(timeval t) { mStamp = t; }
+		const std::string& getRobotName() const { return mRobotName; }
+		const std::string& getSensorName() const { return mSensorName; }
+		SensorId getSensorId() const { return mSensorId; }
 		boost::uuids::uuid getUniqueId() const { return mUniqueId; }
-		Transform getSensorPose() const { return mSensorPose; }
-		Transform getInverseSensorPose() const { return mInverseSensorPose; }
-		
+		const Transform& getSensorPose() const { return mSensorPose; }
+		const Transform& getInverseSensorPose() const { return mInverseSensorPose; }
+
+		/**
+		 * @brief Write the sensor-specific payload to the given stream.
+		 * @details The base class has no payload and writes nothing.
+		 * Specific measurements should override this together with
+		 * deserialize() to make their data persistent, e.g. for
+		 * Graph::save() or exchange between robots.
+		 * @param out
+		 */
+		virtual void serialize(std::ostream& out) const {}
+
+		/**
+		 * @brief Read the sensor-specific payload from the given stream.
+		 * @details Must read exactly what serialize() has written.
+		 * @param in
+		 */
+		virtual void deserialize(std::istream& in) {}
+
+		/**
+		 * @brief Attach an out-of-core storage to this measurement.
+		 * @details Called by MeasurementStorage when the measurement is
+		 * added to it. Once attached, the payload may be released by the
+		 * storage and is restored transparently on the next access.
+		 * @param storage
+		 */
+		void setStorage(MeasurementStorage* storage) { mStorage = storage; }
+
+		/**
+		 * @brief Whether the payload is currently held in memory.
+		 * @details The base class has no payload and is always resident.
+		 * Specific measurements that support the out-of-core storage
+		 * should override this together with releasePayload().
+		 */
+		virtual bool isPayloadResident() const { return true; }
+
+		/**
+		 * @brief Release the payload from memory.
+		 * @details Must only be called with the payload mutex held; an
+		 * attached storage that holds a serialized copy of the payload
+		 * releases it through tryReleasePayload().
+		 */
+		virtual void releasePayload() {}
+
+		/**
+		 * @brief Release the payload unless it is currently checked out.
+		 * @details Called by an attached storage when it evicts payloads.
+		 * The payload mutex is only tried, so an accessor that is inside
+		 * fetchPayload() or still reading the payload blocks the release
+		 * and the storage moves on to the next candidate.
+		 * @return true if the payload was released
+		 */
+		bool tryReleasePayload()
+		{
+			std::unique_lock<std::mutex> guard(mPayloadMutex, std::try_to_lock);
+			if(!guard.owns_lock())
+			{
+				return false;
+			}
+			releasePayload();
+			return true;
+		}
+
+	protected:
+		/**
+		 * @brief Make sure the payload is in memory before it is accessed.
+		 * @details Restores a released payload from the attached storage
+		 * and updates its position in the storage's LRU order. Specific
+		 * measurements should call this in their payload accessors.
+		 */
+		void fetchPayload() const;
+
 	protected:
 		timeval mStamp;
 		std::string mRobotName;
 		std::string mSensorName;
+		SensorId mSensorId;
 		boost::uuids::uuid mUniqueId;
 		
 		Transform mSensorPose;
 		Transform mInverseSensorPose;
+		MeasurementStorage* mStorage;
+
+		// Guards the payload against release while it is being accessed.
+		// Payload accessors of specific measurements must hold it across
+		// fetchPayload() and the read of their payload members.
+		mutable std::mutex mPayloadMutex;
 	};
 	
+	/**
+	 * @class MeasurementFactory
+	 * @brief Creates measurements of the correct specific type when a
+	 * saved graph is loaded from file.
+	 * @details Implementations should create the measurement type of the
+	 * sensor with the given name, so that deserialize() can restore the
+	 * sensor-specific payload afterwards.
+	 */
+	class MeasurementFactory
+	{
+	public:
+		virtual ~MeasurementFactory(){}
+
+		/**
+		 * @brief Create an empty measurement for the given sensor.
+		 * @param robot name of the robot that acquired the measurement
+		 * @param sensor name of the sensor that created the measurement
+		 * @param pose pose of the sensor in the robot's coordinate frame
+		 * @param id unique identifier of the measurement
+		 */
+		virtual Measurement::Ptr create(const std::string& robot,
+		                                const std::string& sensor,
+		                                const Transform& pose,
+		                                const boost::uuids::uuid& id)
+		{
+			return std::make_shared<Measurement>(robot, sensor, pose, id);
+		}
+	};
+
 	enum ConstraintType {TENTATIVE, SE3, GRAVITY, POSITION, ORIENTATION};
 	
 	/**
@@ -110,20 +241,35 @@ namespace slam3d
 	class Constraint
 	{
 	public:
-		typedef boost::shared_ptr<Constraint> Ptr;
+		typedef std::shared_ptr<Constraint> Ptr;
 		
 	public:
-		Constraint(const std::string& sensor) : mSensorName(sensor) {}
+		Constraint(const std::string& sensor)
+		 : mSensorName(sensor), mSensorId(SensorIndex::resolve(sensor)) {}
 		virtual ~Constraint(){}
 		virtual ConstraintType getType() = 0;
 		virtual const char* getTypeName() = 0;
 
+		/**
+		 * @brief Pooled allocation for constraint objects.
+		 * @details Constraints are created at a high rate for the whole
+		 * lifetime of the process. Serving them from size-segregated pools
+		 * instead of the general heap avoids fragmenting it with thousands
+		 * of small allocations, and freed constraints are reused without
+		 * going back to the allocator. Constraints must therefore be
+		 * allocated with new; std::make_shared would bypass the pool.
+		 */
+		static void* operator new(std::size_t size);
+		static void operator delete(void* p, std::size_t size);
+
 		timeval getTimestamp() const { return mStamp; }
 		const std::string& getSensorName() const { return mSensorName; }
+		SensorId getSensorId() const { return mSensorId; }
 
 	protected:
 		timeval mStamp;
 		std::string mSensorName;
+		SensorId mSensorId;
 	};
 	
 	/**
@@ -133,7 +279,7 @@ namespace slam3d
 	class SE3Constraint : public Constraint
 	{
 	public:
-		typedef boost::shared_ptr<SE3Constraint> Ptr;
+		typedef std::shared_ptr<SE3Constraint> Ptr;
 		
 		SE3Constraint(const std::string& s, const Transform& t, const Covariance<6>& i)
 		: Constraint(s), mRelativePose(t), mInformation(i) {}
@@ -157,7 +303,7 @@ namespace slam3d
 	class GravityConstraint : public Constraint
 	{
 	public:
-		typedef boost::shared_ptr<GravityConstraint> Ptr;
+		typedef std::shared_ptr<GravityConstraint> Ptr;
 		
 		GravityConstraint(const std::string& s, const Direction& d, const Direction& r, const Covariance<2>& c)
 		: Constraint(s), mDirection(d), mReference(r), mCovariance(c) {}
@@ -182,7 +328,7 @@ namespace slam3d
 	class PositionConstraint : public Constraint
 	{
 	public:
-		typedef boost::shared_ptr<PositionConstraint> Ptr;
+		typedef std::shared_ptr<PositionConstraint> Ptr;
 		
 		PositionConstraint(const std::string& s,
 		                   const Position& p,
@@ -210,7 +356,7 @@ namespace slam3d
 	class OrientationConstraint : public Constraint
 	{
 	public:
-		typedef boost::shared_ptr<OrientationConstraint> Ptr;
+		typedef std::shared_ptr<OrientationConstraint> Ptr;
 		
 		OrientationConstraint(const std::string& s,
 		                      const Quaternion& q,
@@ -253,7 +399,6 @@ namespace slam3d
 	struct VertexObject
 	{
 		IdType index;
-		std::string label;
 		Transform corrected_pose;
 		Measurement::Ptr measurement;
 	};
@@ -267,7 +412,6 @@ namespace slam3d
 	 */
 	struct EdgeObject
 	{
-		std::string label;
 		IdType source;
 		IdType target;
 		Constraint::Ptr constraint;
@@ -8,38 +8,48 @@
 #include <slam3d/core/Solver.hpp>
 
 #include <boost/format.hpp>
-#include <boost/graph/visitors.hpp>
-#include <boost/graph/breadth_first_search.hpp>
 #include <boost/graph/dijkstra_shortest_paths.hpp>
 #include <boost/property_map/property_map.hpp>
 #include <boost/graph/graphviz.hpp>
 
 #include <fstream>
+#include <queue>
 
 using namespace slam3d;
 
 BoostGraph::BoostGraph(Logger* log)
- : Graph(log)
+ : Graph(log), mDistanceCacheSource(0),
+   mDistanceCacheLimit(0), mDistanceCacheValid(false)
 {
 }
 
 BoostGraph::~BoostGraph()
 {
+	if(mExportThread.joinable())
+		mExportThread.join();
 }
 
 EdgeObjectList BoostGraph::getEdgesFromSensor(const std::string& sensor) const
 {
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
 	EdgeObjectList objectList;
-	EdgeRange edges = boost::edges(mPoseGraph);
-	for(EdgeIterator it = edges.first; it != edges.second; ++it)
+	if(sensor == "")
 	{
-		EdgeObject eo = mPoseGraph[*it];
-		IdType source_id = mPoseGraph[boost::source(*it, mPoseGraph)].index;
-		bool add_sensor = (sensor == "") || (sensor == eo.constraint->getSensorName());
-		if(add_sensor && eo.source == source_id)
+		// Query all edges regardless of their sensor
+		EdgeRange edges = boost::edges(mPoseGraph);
+		for(EdgeIterator it = edges.first; it != edges.second; ++it)
 		{
 			objectList.push_back(mPoseGraph[*it]);
 		}
+		return objectList;
+	}
+
+	SensorEdgeIndex::const_iterator index = mSensorEdgeIndex.find(sensor);
+	if(index == mSensorEdgeIndex.end())
+		return objectList;
+	for(auto edge : index->second)
+	{
+		objectList.push_back(mPoseGraph[*getEdgeIterator(edge.first, edge.second, sensor)]);
 	}
 	return objectList;
 }
@@ -47,9 +57,17 @@ EdgeObjectList BoostGraph::getEdgesFromSensor(const std::string& sensor) const
 bool BoostGraph::optimize(unsigned iterations)
 {
 	boost::unique_lock<boost::shared_mutex> guard(mGraphMutex);
+	mDistanceCacheValid = false;
 	return Graph::optimize(iterations);
 }
 
+void BoostGraph::applyOptimization()
+{
+	boost::unique_lock<boost::shared_mutex> guard(mGraphMutex);
+	mDistanceCacheValid = false;
+	Graph::applyOptimization();
+}
+
 void BoostGraph::addVertex(const VertexObject& v)
 {
 	boost::unique_lock<boost::shared_mutex> guard(mGraphMutex);
@@ -60,23 +78,29 @@ void BoostGraph::addVertex(const VertexObject& v)
 
 	// Add it to the vertex index, so we can find it by its descriptor
 	mIndexMap.insert(IndexMap::value_type(v.index, newVertex));
+
+	// Add it to the sensor index, so getVerticesFromSensor() does not
+	// have to scan the whole graph
+	mSensorVertexIndex[v.measurement->getSensorName()].push_back(newVertex);
+	mDistanceCacheValid = false;
 }
 
 void BoostGraph::addEdge(const EdgeObject& e)
 {
 	boost::unique_lock<boost::shared_mutex> guard(mGraphMutex);
-	Edge forward_edge, inverse_edge;
-	bool inserted_forward, inserted_inverse;
-	
+	Edge newEdge;
+	bool inserted;
+
 	Vertex source = mIndexMap[e.source];
 	Vertex target = mIndexMap[e.target];
-	boost::tie(forward_edge, inserted_forward) = boost::add_edge(source, target, mPoseGraph);
-	boost::tie(inverse_edge, inserted_inverse) = boost::add_edge(target, source, mPoseGraph);
+	boost::tie(newEdge, inserted) = boost::add_edge(source, target, mPoseGraph);
 
-	if(inserted_forward && inserted_inverse)
+	if(inserted)
 	{
-		mPoseGraph[forward_edge] = e;
-		mPoseGraph[inverse_edge] = e;
+		// The payload is stored only once and shared by both directions
+		mPoseGraph[newEdge] = e;
+		mSensorEdgeIndex[e.constraint->getSensorName()].push_back(std::make_pair(e.source, e.target));
+		mDistanceCacheValid = false;
 	}else
 	{
 		mLogger->message(WARNING, (boost::format("Could not add an edge (%1%,%2%) to the BoostGraph.") % e.source % e.target).str());
@@ -86,35 +110,129 @@ void BoostGraph::addEdge(const EdgeObject& e)
 
 void BoostGraph::removeEdge(IdType source, IdType target, const std::string& sensor)
 {
+	boost::unique_lock<boost::shared_mutex> guard(mGraphMutex);
 	boost::remove_edge(getEdgeIterator(source, target, sensor), mPoseGraph);
+
+	// Remove it from the sensor index as well
+	std::vector< std::pair<IdType, IdType> >& edges = mSensorEdgeIndex[sensor];
+	for(auto it = edges.begin(); it != edges.end(); ++it)
+	{
+		if(it->first == source && it->second == target)
+		{
+			edges.erase(it);
+			break;
+		}
+	}
+	mDistanceCacheValid = false;
 }
 
-VertexObjectList BoostGraph::getVerticesFromSensor(const std::string& sensor) const
+void BoostGraph::removeVertexInternal(IdType id)
+{
+	boost::unique_lock<boost::shared_mutex> guard(mGraphMutex);
+	IndexMap::iterator it = mIndexMap.find(id);
+	if(it == mIndexMap.end())
+	{
+		throw InvalidVertex(id);
+	}
+
+	// Purge all edge index entries that refer to this vertex
+	for(SensorEdgeIndex::iterator s = mSensorEdgeIndex.begin(); s != mSensorEdgeIndex.end(); ++s)
+	{
+		std::vector< std::pair<IdType, IdType> >& edges = s->second;
+		for(auto e = edges.begin(); e != edges.end();)
+		{
+			if(e->first == id || e->second == id)
+				e = edges.erase(e);
+			else
+				++e;
+		}
+	}
+
+	// Remove the vertex together with all incident edges
+	boost::clear_vertex(it->second, mPoseGraph);
+	boost::remove_vertex(it->second, mPoseGraph);
+
+	// The removal shifts the underlying vertex vector, which invalidates
+	// all stored descriptors, so the indices are rebuilt from the graph.
+	mIndexMap.clear();
+	mSensorVertexIndex.clear();
+	VertexRange vertices = boost::vertices(mPoseGraph);
+	for(VertexIterator v = vertices.first; v != vertices.second; ++v)
+	{
+		const VertexObject& obj = mPoseGraph[*v];
+		mIndexMap.insert(IndexMap::value_type(obj.index, *v));
+		mSensorVertexIndex[obj.measurement->getSensorName()].push_back(*v);
+	}
+	mDistanceCacheValid = false;
+}
+
+VertexObjectList BoostGraph::getAllVertices() const
 {
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
 	VertexObjectList objectList;
 	VertexRange vertices = boost::vertices(mPoseGraph);
 	for(VertexIterator it = vertices.first; it != vertices.second; ++it)
 	{
-		if(mPoseGraph[*it].measurement->getSensorName() == sensor)
-		{
-			objectList.push_back(mPoseGraph[*it]);
-		}
+		objectList.push_back(mPoseGraph[*it]);
 	}
 	return objectList;
 }
 
+VertexObjectList BoostGraph::getVerticesFromSensor(const std::string& sensor) const
+{
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
+	VertexObjectList objectList;
+	SensorVertexIndex::const_iterator index = mSensorVertexIndex.find(sensor);
+	if(index == mSensorVertexIndex.end())
+		return objectList;
+	for(Vertex v : index->second)
+	{
+		objectList.push_back(mPoseGraph[v]);
+	}
+	return objectList;
+}
+
+void BoostGraph::forEachVertexFromSensor(const std::string& sensor,
+                                         const std::function<void(const VertexObject&)>& func) const
+{
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
+	SensorVertexIndex::const_iterator index = mSensorVertexIndex.find(sensor);
+	if(index == mSensorVertexIndex.end())
+		return;
+	for(Vertex v : index->second)
+	{
+		func(mPoseGraph[v]);
+	}
+}
+
 const VertexObject& BoostGraph::getVertex(IdType id) const
 {
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
 	return mPoseGraph[mIndexMap.at(id)];
 }
 
 VertexObject& BoostGraph::getVertexInternal(IdType id)
 {
+	// No lock here: this is used on the solver path, where the
+	// unique lock is already held by optimize().
 	return mPoseGraph[mIndexMap.at(id)];
 }
 
+void BoostGraph::setCorrectedPose(IdType id, const Transform& pose)
+{
+	boost::unique_lock<boost::shared_mutex> guard(mGraphMutex);
+	Graph::setCorrectedPose(id, pose);
+}
+
+void BoostGraph::replaceConstraint(IdType source, IdType target, Constraint::Ptr constraint)
+{
+	boost::unique_lock<boost::shared_mutex> guard(mGraphMutex);
+	Graph::replaceConstraint(source, target, constraint);
+}
+
 const EdgeObject& BoostGraph::getEdge(IdType source, IdType target, const std::string& sensor) const
 {
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
 	OutEdgeIterator it = getEdgeIterator(source, target, sensor);
 	return mPoseGraph[*it];
 }
@@ -127,6 +245,8 @@ EdgeObject& BoostGraph::getEdgeInternal(IdType source, IdType target, const std:
 
 OutEdgeIterator BoostGraph::getEdgeIterator(IdType source, IdType target, const std::string& sensor) const
 {
+	// Resolve the sensor name once, so matching is an integer compare
+	SensorId sensor_id = SensorIndex::resolve(sensor);
 	OutEdgeIterator it, it_end;
 	try
 	{
@@ -138,7 +258,7 @@ OutEdgeIterator BoostGraph::getEdgeIterator(IdType source, IdType target, const
 	while(it != it_end)
 	{
 		const VertexObject& tObject = mPoseGraph[boost::target(*it, mPoseGraph)];
-		if(tObject.index == target && mPoseGraph[*it].constraint->getSensorName() == sensor)
+		if(tObject.index == target && mPoseGraph[*it].constraint->getSensorId() == sensor_id)
 		{
 			return it;
 		}
@@ -149,6 +269,7 @@ OutEdgeIterator BoostGraph::getEdgeIterator(IdType source, IdType target, const
 
 EdgeObjectList BoostGraph::getOutEdges(IdType source) const
 {
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
 	OutEdgeIterator it, it_end;
 	boost::tie(it, it_end) = boost::out_edges(mIndexMap.at(source), mPoseGraph);
 	EdgeObjectList edges;
@@ -162,6 +283,7 @@ EdgeObjectList BoostGraph::getOutEdges(IdType source) const
 
 EdgeObjectList BoostGraph::getEdges(const VertexObjectList& vertices) const
 {
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
 	std::set<int> v_ids;
 	for(VertexObjectList::const_iterator v = vertices.begin(); v != vertices.end(); v++)
 	{
@@ -178,23 +300,73 @@ EdgeObjectList BoostGraph::getEdges(const VertexObjectList& vertices) const
 	return objectList;
 }
 
-void BoostGraph::writeGraphToFile(const std::string& name)
+BoostGraph::ExportSnapshot BoostGraph::takeExportSnapshot() const
+{
+	// Copy only indices and labels; this is much cheaper than holding
+	// the lock while the file is written. Labels are not stored in the
+	// graph, they are generated here on demand.
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
+	ExportSnapshot snapshot;
+	snapshot.vertices.reserve(boost::num_vertices(mPoseGraph));
+	VertexRange vertices = boost::vertices(mPoseGraph);
+	for(VertexIterator it = vertices.first; it != vertices.second; ++it)
+	{
+		const VertexObject& obj = mPoseGraph[*it];
+		boost::format label("%1%:%2%(%3%)");
+		label % obj.measurement->getRobotName() % obj.measurement->getSensorName() % obj.index;
+		snapshot.vertices.push_back(std::make_pair(obj.index, label.str()));
+	}
+	snapshot.edges.reserve(boost::num_edges(mPoseGraph));
+	EdgeRange edges = boost::edges(mPoseGraph);
+	for(EdgeIterator it = edges.first; it != edges.second; ++it)
+	{
+		ExportEdge edge;
+		edge.source = mPoseGraph[*it].source;
+		edge.target = mPoseGraph[*it].target;
+		edge.label = mPoseGraph[*it].constraint->getSensorName();
+		snapshot.edges.push_back(edge);
+	}
+	return snapshot;
+}
+
+void BoostGraph::writeDotFile(const std::string& file, const ExportSnapshot& snapshot)
 {
-	boost::unique_lock<boost::shared_mutex> guard(mGraphMutex);
-	std::string file = name + ".dot";
-	mLogger->message(INFO, (boost::format("Writing graph to file '%1%'.") % file).str());
 	std::ofstream ofs;
 	ofs.open(file.c_str());
-	boost::write_graphviz(
-			ofs,
-			mPoseGraph,
-			boost::make_label_writer(boost::get(&VertexObject::label, mPoseGraph)),
-			boost::make_label_writer(boost::get(&EdgeObject::label, mPoseGraph)),
-			boost::default_writer(),
-			boost::get(&VertexObject::index, mPoseGraph));
+	ofs << "digraph G {\n";
+	for(auto vertex : snapshot.vertices)
+	{
+		ofs << vertex.first << "[label=\"" << vertex.second << "\"];\n";
+	}
+	for(auto edge : snapshot.edges)
+	{
+		ofs << edge.source << "->" << edge.target << "[label=\"" << edge.label << "\"];\n";
+	}
+	ofs << "}\n";
 	ofs.close();
 }
 
+void BoostGraph::writeGraphToFile(const std::string& name)
+{
+	std::string file = name + ".dot";
+	mLogger->message(INFO, (boost::format("Writing graph to file '%1%'.") % file).str());
+	writeDotFile(file, takeExportSnapshot());
+}
+
+void BoostGraph::writeGraphToFileAsync(const std::string& name)
+{
+	std::string file = name + ".dot";
+	mLogger->message(INFO, (boost::format("Writing graph to file '%1%' in the background.") % file).str());
+
+	// Snapshot on the calling thread, serialize on the background thread.
+	// Finish a still running export first, so two exports never write
+	// concurrently.
+	if(mExportThread.joinable())
+		mExportThread.join();
+	ExportSnapshot snapshot = takeExportSnapshot();
+	mExportThread = boost::thread([file, snapshot]() { writeDotFile(file, snapshot); });
+}
+
 // ================================================================
 // BFS search for vertices with a maximum distance to a source node
 // ================================================================
@@ -207,59 +379,64 @@ struct EdgeFilter
 	{
 		return (*graph)[e].constraint->getType() == SE3;
 	}
-	
-	const AdjacencyGraph* graph;
-};
 
-typedef boost::filtered_graph<AdjacencyGraph, EdgeFilter> FilteredGraph;
-typedef std::map<FilteredGraph::vertex_descriptor, boost::default_color_type> ColorMap;
-typedef std::map<FilteredGraph::vertex_descriptor, unsigned> DepthMap;
-
-/**
- * @class MaxDepthVisitor
- * @brief BFS-Visitor to find nearby nodes in the graph.
- */
-class MaxDepthVisitor : public boost::default_bfs_visitor
-{
-public:
-	MaxDepthVisitor(DepthMap& map, unsigned d) : depth_map(map), max_depth(d) {}
-
-	void tree_edge(FilteredGraph::edge_descriptor e, const FilteredGraph& g)
-	{
-		FilteredGraph::vertex_descriptor u = source(e, g);
-		FilteredGraph::vertex_descriptor v = target(e, g);
-		if(depth_map[u] >= max_depth)
-			throw 0;
-		depth_map[v] = depth_map[u] + 1;
-	}
-private:
-	DepthMap& depth_map;
-	unsigned max_depth;
+	const AdjacencyGraph* graph;
 };
 
 VertexObjectList BoostGraph::getVerticesInRange(IdType source_id, unsigned range) const
 {
-	// Create required data structures
-	Vertex source = mIndexMap.at(source_id);
-	DepthMap depth_map;
-	depth_map[source] = 0;
-	ColorMap c_map;
-	MaxDepthVisitor vis(depth_map, range);
-	
-	// Do BFS on filtered graph
-	FilteredGraph fg(mPoseGraph, EdgeFilter(&mPoseGraph));
-	try
-	{
-		boost::breadth_first_search(fg, source, boost::visitor(vis).color_map(boost::associative_property_map<ColorMap>(c_map)));
-	}catch(int e)
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
+	IndexMap::const_iterator source = mIndexMap.find(source_id);
+	if(source == mIndexMap.end())
 	{
+		throw InvalidVertex(source_id);
 	}
 
-	// Write the result
+	// The per-vertex storage is reused across calls; instead of clearing it
+	// every time, a vertex counts as visited when its stamp is current.
+	// Vertex IDs are assigned continuously, so they can index a flat array.
+	// The buffers are thread_local, as patch building may run this from
+	// several link workers at once, which only hold the shared lock.
+	thread_local std::vector<unsigned> visitedStamp;
+	thread_local std::vector<unsigned> searchDepth;
+	thread_local VertexList searchQueue;
+	thread_local unsigned searchStamp = 0;
+
+	std::size_t needed = mIndexMap.rbegin()->first + 1;
+	if(visitedStamp.size() < needed)
+		visitedStamp.resize(needed, 0);
+	++searchStamp;
+
+	searchQueue.clear();
+	searchDepth.clear();
+	searchQueue.push_back(source->second);
+	searchDepth.push_back(0);
+	visitedStamp[source_id] = searchStamp;
+
+	// Do BFS with a non-throwing depth cutoff
 	VertexObjectList vertices;
-	for(DepthMap::iterator it = depth_map.begin(); it != depth_map.end(); ++it)
+	for(std::size_t head = 0; head < searchQueue.size(); ++head)
 	{
-		vertices.push_back(mPoseGraph[it->first]);
+		Vertex u = searchQueue[head];
+		unsigned depth = searchDepth[head];
+		vertices.push_back(mPoseGraph[u]);
+		if(depth >= range)
+			continue;
+
+		OutEdgeIterator it, it_end;
+		boost::tie(it, it_end) = boost::out_edges(u, mPoseGraph);
+		for(; it != it_end; ++it)
+		{
+			if(mPoseGraph[*it].constraint->getType() != SE3)
+				continue;
+			Vertex v = boost::target(*it, mPoseGraph);
+			IdType v_id = mPoseGraph[v].index;
+			if(visitedStamp[v_id] == searchStamp)
+				continue;
+			visitedStamp[v_id] = searchStamp;
+			searchQueue.push_back(v);
+			searchDepth.push_back(depth + 1);
+		}
 	}
 	return vertices;
 }
@@ -288,3 +465,60 @@ float BoostGraph::calculateGraphDistance(IdType source_id, IdType target_id)
 
 	return distance[mIndexMap.at(target_id)];
 }
+
+std::map<IdType, float> BoostGraph::calculateGraphDistances(IdType source_id,
+                                                            const std::vector<IdType>& targets,
+                                                            float maxDistance)
+{
+	boost::unique_lock<boost::shared_mutex> guard(mGraphMutex);
+
+	if(!mDistanceCacheValid || mDistanceCacheSource != source_id || mDistanceCacheLimit < maxDistance)
+	{
+		IndexMap::const_iterator source = mIndexMap.find(source_id);
+		if(source == mIndexMap.end())
+		{
+			throw InvalidVertex(source_id);
+		}
+		mDistanceCache.clear();
+
+		// Do a Dijkstra-search that settles all vertices within maxDistance
+		// in one pass, instead of one full search per target. Non-SE3 edges
+		// are penalized like in calculateGraphDistance.
+		EdgeFilter filter(&mPoseGraph);
+		typedef std::pair<float, Vertex> QueueEntry;
+		std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> > queue;
+		queue.push(QueueEntry(0, source->second));
+		while(!queue.empty())
+		{
+			float dist = queue.top().first;
+			Vertex u = queue.top().second;
+			queue.pop();
+			IdType u_id = mPoseGraph[u].index;
+			if(mDistanceCache.find(u_id) != mDistanceCache.end())
+				continue;
+			mDistanceCache[u_id] = dist;
+
+			OutEdgeIterator it, it_end;
+			boost::tie(it, it_end) = boost::out_edges(u, mPoseGraph);
+			for(; it != it_end; ++it)
+			{
+				float weight = filter(*it) ? 1.0 : 10000;
+				if(dist + weight > maxDistance)
+					continue;
+				queue.push(QueueEntry(dist + weight, boost::target(*it, mPoseGraph)));
+			}
+		}
+		mDistanceCacheSource = source_id;
+		mDistanceCacheLimit = maxDistance;
+		mDistanceCacheValid = true;
+	}
+
+	std::map<IdType, float> result;
+	for(IdType target : targets)
+	{
+		std::map<IdType, float>::const_iterator it = mDistanceCache.find(target);
+		if(it != mDistanceCache.end() && it->second <= maxDistance)
+			result[target] = it->second;
+	}
+	return result;
+}
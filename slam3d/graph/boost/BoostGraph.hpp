@@ -6,13 +6,17 @@
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/graphviz.hpp>
 #include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 namespace slam3d
 {
 	// Definitions of boost-graph related types
+	// The graph is stored undirected, so each constraint exists only once
+	// and is shared by both traversal directions. The logical direction is
+	// kept in the EdgeObject's source and target fields.
 	typedef boost::listS VRep;
 	typedef boost::vecS ERep;
-	typedef boost::directedS GType;
+	typedef boost::undirectedS GType;
 	typedef boost::adjacency_list<VRep, ERep, GType, VertexObject, EdgeObject> AdjacencyGraph;
 	
 	typedef boost::graph_traits<AdjacencyGraph>::vertex_descriptor Vertex;
@@ -34,6 +38,8 @@ namespace slam3d
 
 	// Index types
 	typedef std::map<IdType, Vertex> IndexMap;
+	typedef std::map<std::string, VertexList> SensorVertexIndex;
+	typedef std::map<std::string, std::vector< std::pair<IdType, IdType> > > SensorEdgeIndex;
 	
 	/**
 	 * @class BoostGraph
@@ -52,7 +58,32 @@ namespace slam3d
 		 * @return true if optimization was successful
 		 */
 		bool optimize(unsigned iterations = 100);
-		
+
+		/**
+		 * @brief Apply the corrections of the last computeOptimization().
+		 * @details Takes the write lock around the base implementation,
+		 * so all corrected poses change atomically for readers.
+		 */
+		void applyOptimization();
+
+		/**
+		 * @brief Set the corrected pose for the vertex with the given ID.
+		 * @details Takes the write lock around the base implementation.
+		 * @param id
+		 * @param pose
+		 */
+		void setCorrectedPose(IdType id, const Transform& pose);
+
+		/**
+		 * @brief Replace the constraint of the same sensor for the specified edge.
+		 * @details Takes the write lock around the base implementation.
+		 * @param source
+		 * @param target
+		 * @param constraint
+		 */
+		void replaceConstraint(IdType source, IdType target, Constraint::Ptr constraint);
+
+
 		/**
 		 * @brief 
 		 * @param id
@@ -74,11 +105,25 @@ namespace slam3d
 		 */
 		EdgeObjectList getOutEdges(IdType source) const;
 		
+		/**
+		 * @brief Gets a list of all vertices in the graph.
+		 */
+		VertexObjectList getAllVertices() const;
+
 		/**
 		 * @brief Gets a list of all vertices from given sensor.
 		 * @param sensor
 		 */
 		VertexObjectList getVerticesFromSensor(const std::string& sensor) const;
+
+		/**
+		 * @brief Applies the given function to each vertex from given sensor.
+		 * @details The function is called while the read lock is held.
+		 * @param sensor
+		 * @param func
+		 */
+		void forEachVertexFromSensor(const std::string& sensor,
+		                             const std::function<void(const VertexObject&)>& func) const;
 		
 		/**
 		 * @brief Serch for nodes by using breadth-first-search
@@ -105,14 +150,39 @@ namespace slam3d
 		 * @param target
 		 */
 		float calculateGraphDistance(IdType source, IdType target);
+
+		/**
+		 * @brief Calculates graph distances from source to many targets at once.
+		 * @details Runs a single Dijkstra bounded by maxDistance and caches the
+		 * settled distances, so repeated queries from the same source are served
+		 * without another traversal until the graph changes.
+		 * @param source
+		 * @param targets
+		 * @param maxDistance
+		 */
+		std::map<IdType, float> calculateGraphDistances(IdType source,
+		                                                const std::vector<IdType>& targets,
+		                                                float maxDistance);
 		
 		/**
 		 * @brief Write the current graph to a file (currently dot).
-		 * @details For larger graphs, this can take a very long time.
+		 * @details The graph structure is copied under the read lock and
+		 * serialized afterwards, so mapping is only blocked for the copy,
+		 * not for the file output.
 		 * @param name filename without type ending
 		 */
 		void writeGraphToFile(const std::string &name);
 
+		/**
+		 * @brief Write the current graph to a file on a background thread.
+		 * @details Takes the snapshot immediately, but does the
+		 * serialization asynchronously, so periodic map dumps have a
+		 * bounded impact on the ingestion path. A previously started
+		 * export is finished before the new one begins.
+		 * @param name filename without type ending
+		 */
+		void writeGraphToFileAsync(const std::string &name);
+
 	protected:
 		/**
 		 * @brief Add the given VertexObject to the internal graph.
@@ -127,13 +197,22 @@ namespace slam3d
 		virtual void addEdge(const EdgeObject& e);
 		
 		/**
-		 * @brief 
+		 * @brief
 		 * @param source
 		 * @param target
 		 * @param sensor
 		 */
 		virtual void removeEdge(IdType source, IdType target, const std::string& sensor);
 
+		/**
+		 * @brief Remove the given vertex and its edges from the graph.
+		 * @details Removing from the underlying vertex vector invalidates
+		 * the stored descriptors, so the vertex and sensor indices are
+		 * rebuilt afterwards.
+		 * @param id
+		 */
+		virtual void removeVertexInternal(IdType id);
+
 		/**
 		 * @brief Get a writable reference to a VertexObject.
 		 * @param id
@@ -156,15 +235,49 @@ namespace slam3d
 		 */
 		OutEdgeIterator getEdgeIterator(IdType source, IdType target, const std::string& sensor) const;
 
+	private:
+		// Compact copy of the graph structure, taken under the read lock
+		// and serialized without it
+		struct ExportEdge
+		{
+			IdType source;
+			IdType target;
+			std::string label;
+		};
+
+		struct ExportSnapshot
+		{
+			std::vector< std::pair<IdType, std::string> > vertices;
+			std::vector<ExportEdge> edges;
+		};
+
+		ExportSnapshot takeExportSnapshot() const;
+		static void writeDotFile(const std::string& file, const ExportSnapshot& snapshot);
+
 	private:
 		// The boost graph object
 		AdjacencyGraph mPoseGraph;
+
+		// Currently running background export, if any
+		boost::thread mExportThread;
 		
 		// Mutex for graph access
 		mutable boost::shared_mutex mGraphMutex;
 		
 		// Index to map a vertex' id to its descriptor
 		IndexMap mIndexMap;
+
+		// Secondary indices to query vertices and edges by their sensor
+		// without scanning the whole graph
+		SensorVertexIndex mSensorVertexIndex;
+		SensorEdgeIndex mSensorEdgeIndex;
+
+		// Cached result of the last bounded distance query, invalidated
+		// whenever the graph structure or the poses change
+		std::map<IdType, float> mDistanceCache;
+		IdType mDistanceCacheSource;
+		float mDistanceCacheLimit;
+		bool mDistanceCacheValid;
 	};
 }
 
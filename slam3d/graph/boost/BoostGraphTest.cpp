@@ -16,3 +16,15 @@ BOOST_AUTO_TEST_CASE(boost_graph_construction)
 	test_graph_construction(graph);
 	delete graph;
 }
+
+BOOST_AUTO_TEST_CASE(boost_graph_persistence)
+{
+	Clock clock;
+	FileLogger logger(clock, "boost_graph.log");
+	logger.setLogLevel(DEBUG);
+	Graph* source = new BoostGraph(&logger);
+	Graph* restored = new BoostGraph(&logger);
+	test_graph_persistence(source, restored);
+	delete source;
+	delete restored;
+}
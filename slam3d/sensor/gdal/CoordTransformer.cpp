@@ -22,21 +22,38 @@ void CoordTransformer::init(int utmZone, bool utmNorth)
 }
 
 Position CoordTransformer::toUTM(ScalarType lon, ScalarType lat, ScalarType alt)
+{
+	toUTM(1, &lon, &lat, &alt);
+	Position utm;
+	utm(0) = lon;
+	utm(1) = lat;
+	utm(2) = alt;
+	return utm;
+}
+
+void CoordTransformer::toUTM(std::size_t count, ScalarType* lon, ScalarType* lat, ScalarType* alt)
 {
 	if(!mCoordTransform)
 	{
 		throw std::runtime_error("You must call CoordTransformer::init before using toUTM()!");
 	}
 
-	if(!mCoordTransform->Transform(1, &lon, &lat, &alt))
+	if(count == 0)
+	{
+		return;
+	}
+
+	if(!mCoordTransform->Transform(count, lon, lat, alt))
 	{
 		throw std::runtime_error("Transformation failed!");
 	}
-	Position utm;
-	utm(0) = lon;
-	utm(1) = lat;
-	utm(2) = alt;
-	return utm - mReference;
+
+	for(std::size_t i = 0; i < count; i++)
+	{
+		lon[i] -= mReference(0);
+		lat[i] -= mReference(1);
+		alt[i] -= mReference(2);
+	}
 }
 
 void CoordTransformer::setReference(ScalarType lon, ScalarType lat, ScalarType alt)
@@ -41,6 +41,10 @@ namespace slam3d
 		void setReference(ScalarType lon, ScalarType lat, ScalarType alt);
 		Position toUTM(ScalarType lon, ScalarType lat, ScalarType alt);
 
+		// Transforms count points in place with a single OGR call, which
+		// is much cheaper than per-point calls at high fix rates
+		void toUTM(std::size_t count, ScalarType* lon, ScalarType* lat, ScalarType* alt);
+
 	protected:
 		OGRCoordinateTransformation* mCoordTransform;
 		Position mReference;
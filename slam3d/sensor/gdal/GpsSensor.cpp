@@ -39,13 +39,103 @@ void GpsSensor::addMeasurement(const GpsMeasurement::Ptr &m)
 	{
 		Position delta = m->getPosition() - mLastPosition;
 		if(delta.norm() < mMinTranslation)
+		{
+			// The robot has not moved; let the fix sharpen the next
+			// constraint instead of creating a solver edge of its own.
+			aggregate(m);
 			return;
+		}
 	}
 
 	mLastVertex = mMapper->addMeasurement(m);
-	Position rel_pos = m->getPosition() - mReference;
-	mLogger->message(DEBUG, (boost::format("GPS: relative pose (%1%, %2%, %3%)") % rel_pos(0) % rel_pos(1) % rel_pos(2)).str());
-	PositionConstraint::Ptr position(new PositionConstraint(mName, rel_pos, m->getCovariance(), m->getSensorPose()));
-	mMapper->getGraph()->addConstraint(mLastVertex, 0, position);
+	aggregate(m);
+
+	// Combine all fixes since the last constraint into one edge. They are
+	// all within mMinTranslation of the current position, so the error of
+	// treating them as one observation is bounded by that threshold.
+	Position rel_pos = (mAggregatedInformation.inverse() * mAggregatedPosition) - mReference;
+	Covariance<3> cov = mAggregatedInformation.inverse();
+	mLogger->message(DEBUG, (boost::format("GPS: relative pose (%1%, %2%, %3%) from %4% fixes")
+	 % rel_pos(0) % rel_pos(1) % rel_pos(2) % mAggregatedCount).str());
+	PositionConstraint::Ptr position(new PositionConstraint(mName, rel_pos, cov, m->getSensorPose()));
+	mMapper->getGraph()->addConstraint(mLastVertex, mAnchorVertex, position);
+
+	// Chain the structural anchor instead of accumulating all unary
+	// edges on vertex 0. The solver treats position constraints as unary
+	// priors, so the target only affects the graph structure.
+	mAnchorVertex = mLastVertex;
+	mAggregatedCount = 0;
+	mAggregatedInformation = Covariance<3>::Zero();
+	mAggregatedPosition = Position::Zero();
 	mLastPosition = m->getPosition();
 }
+
+void GpsSensor::aggregate(const GpsMeasurement::Ptr& m)
+{
+	Covariance<3> info = m->getCovariance().inverse();
+	mAggregatedInformation += info;
+	mAggregatedPosition += info * m->getPosition();
+	mAggregatedCount++;
+}
+
+void GpsSensor::setCoordTransformer(CoordTransformer* transformer, const std::string& robot,
+                                    unsigned batchSize)
+{
+	mLogger->message(INFO, (boost::format("gps_batch_size:         %1%") % batchSize).str());
+	if(mCoordTransformer)
+	{
+		flushRawFixes();
+	}
+	mCoordTransformer = transformer;
+	mRawFixRobot = robot;
+	mBatchSize = batchSize;
+}
+
+void GpsSensor::addRawFix(ScalarType lon, ScalarType lat, ScalarType alt,
+                          const Covariance<3>& cov, timeval t,
+                          const Transform& sensorPose)
+{
+	if(!mCoordTransformer)
+	{
+		throw std::runtime_error("A CoordTransformer must be set before raw fixes can be added!");
+	}
+
+	mPendingLon.push_back(lon);
+	mPendingLat.push_back(lat);
+	mPendingAlt.push_back(alt);
+	RawFixMeta meta;
+	meta.cov = cov;
+	meta.stamp = t;
+	meta.sensorPose = sensorPose;
+	mPendingMeta.push_back(meta);
+
+	if(mPendingMeta.size() >= mBatchSize)
+	{
+		flushRawFixes();
+	}
+}
+
+void GpsSensor::flushRawFixes()
+{
+	if(mPendingMeta.empty())
+	{
+		return;
+	}
+
+	// One transformer call for the whole batch
+	mCoordTransformer->toUTM(mPendingMeta.size(),
+	                         mPendingLon.data(), mPendingLat.data(), mPendingAlt.data());
+
+	for(std::size_t i = 0; i < mPendingMeta.size(); i++)
+	{
+		Position utm(mPendingLon[i], mPendingLat[i], mPendingAlt[i]);
+		GpsMeasurement::Ptr m(new GpsMeasurement(utm, mPendingMeta[i].cov,
+			mPendingMeta[i].stamp, mRawFixRobot, mName, mPendingMeta[i].sensorPose));
+		addMeasurement(m);
+	}
+
+	mPendingLon.clear();
+	mPendingLat.clear();
+	mPendingAlt.clear();
+	mPendingMeta.clear();
+}
@@ -27,13 +27,16 @@
 #define SLAM3D_GPSSENSOR_HPP
 
 #include <slam3d/core/Sensor.hpp>
+#include <slam3d/sensor/gdal/CoordTransformer.hpp>
+
+#include <vector>
 
 namespace slam3d
 {
 	class GpsMeasurement : public Measurement
 	{
 	public:
-		typedef boost::shared_ptr<GpsMeasurement> Ptr;
+		typedef std::shared_ptr<GpsMeasurement> Ptr;
 		
 		GpsMeasurement(const Position& pos, const Covariance<3>& cov,
 		               timeval t, const std::string& r, const std::string& s,
@@ -53,14 +56,65 @@ namespace slam3d
 	class GpsSensor : public Sensor
 	{
 	public:
-		GpsSensor(const std::string& n, Logger* l) : Sensor(n, l){}
+		GpsSensor(const std::string& n, Logger* l)
+		: Sensor(n, l), mCoordTransformer(NULL), mBatchSize(100),
+		  mAnchorVertex(0), mAggregatedCount(0),
+		  mAggregatedInformation(Covariance<3>::Zero()),
+		  mAggregatedPosition(Position::Zero()){}
 		~GpsSensor(){}
-		
+
 		void addMeasurement(const GpsMeasurement::Ptr&m);
-		
+
+		// Use the given transformer to convert buffered raw fixes; it
+		// stays owned by the caller and must be initialized. The robot
+		// name is given to the created measurements.
+		void setCoordTransformer(CoordTransformer* transformer, const std::string& robot,
+		                         unsigned batchSize = 100);
+
+		// Queue a raw WGS84 fix; once the batch is full, all queued fixes
+		// are converted with a single transformer call and added. Much
+		// faster than per-fix conversion when replaying recorded logs.
+		void addRawFix(ScalarType lon, ScalarType lat, ScalarType alt,
+		               const Covariance<3>& cov, timeval t,
+		               const Transform& sensorPose = Transform::Identity());
+
+		// Convert and add all queued fixes, e.g. at the end of a replay
+		void flushRawFixes();
+
 	protected:
+		// Add a fix to the information-weighted aggregate for the next constraint
+		void aggregate(const GpsMeasurement::Ptr& m);
+
 		Position mReference;
 		Position mLastPosition;
+
+		// Structural target of the unary position edges. Each new edge
+		// attaches to the previously constrained vertex, so the edges form
+		// a chain through the graph instead of a star around vertex 0.
+		IdType mAnchorVertex;
+
+		// Fixes received since the last constraint, combined into a single
+		// information-weighted position. Stationary fixes sharpen the next
+		// constraint instead of adding one solver edge each.
+		unsigned mAggregatedCount;
+		Covariance<3> mAggregatedInformation;
+		Position mAggregatedPosition;
+
+		CoordTransformer* mCoordTransformer;
+		std::string mRawFixRobot;
+		unsigned mBatchSize;
+
+		// Pending raw fixes as contiguous arrays for the batch transform
+		std::vector<ScalarType> mPendingLon;
+		std::vector<ScalarType> mPendingLat;
+		std::vector<ScalarType> mPendingAlt;
+		struct RawFixMeta
+		{
+			Covariance<3> cov;
+			timeval stamp;
+			Transform sensorPose;
+		};
+		std::vector<RawFixMeta> mPendingMeta;
 	};
 }
 
@@ -0,0 +1,161 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "IncrementalMap.hpp"
+
+#include <boost/format.hpp>
+
+#include <cmath>
+
+using namespace slam3d;
+
+IncrementalMap::IncrementalMap(Logger* logger, double resolution)
+ : mLogger(logger), mResolution(resolution)
+{
+	mUpdateTranslation = 0.1;
+	mUpdateRotation = 0.05;
+	mMinObservations = 1;
+}
+
+void IncrementalMap::setUpdateThreshold(double translation, double rotation)
+{
+	mLogger->message(INFO, (boost::format("map_update_translation: %1%") % translation).str());
+	mLogger->message(INFO, (boost::format("map_update_rotation:    %1%") % rotation).str());
+	mUpdateTranslation = translation;
+	mUpdateRotation = rotation;
+}
+
+void IncrementalMap::setMinObservations(unsigned n)
+{
+	mLogger->message(INFO, (boost::format("map_min_observations:   %1%") % n).str());
+	mMinObservations = n;
+}
+
+void IncrementalMap::update(const VertexObjectList& vertices)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	unsigned integrated = 0;
+	for(VertexObjectList::const_iterator v = vertices.begin(); v != vertices.end(); ++v)
+	{
+		std::map<IdType, VertexEntry>::iterator it = mVertices.find(v->index);
+		if(it != mVertices.end())
+		{
+			// Keep the cells of vertices that have not moved enough
+			Transform diff = it->second.pose.inverse() * v->corrected_pose;
+			ScalarType angle = Eigen::AngleAxis<ScalarType>(diff.rotation()).angle();
+			if(diff.translation().norm() < mUpdateTranslation && std::abs(angle) < mUpdateRotation)
+				continue;
+
+			removeContributions(it->second);
+			mVertices.erase(it);
+		}
+		integrate(*v);
+		integrated++;
+	}
+	mLogger->message(DEBUG, (boost::format("Map update integrated %1% of %2% vertices.")
+	 % integrated % vertices.size()).str());
+}
+
+void IncrementalMap::integrate(const VertexObject& vertex)
+{
+	PointCloudMeasurement::Ptr m = std::dynamic_pointer_cast<PointCloudMeasurement>(vertex.measurement);
+	if(!m)
+	{
+		mLogger->message(ERROR, "Measurement in IncrementalMap is not a point cloud!");
+		throw BadMeasurementType();
+	}
+
+	// The scan's level at map resolution bounds the work per vertex
+	PointCloud::Ptr cloud = m->getPointCloud(mResolution);
+	Transform tf = vertex.corrected_pose * m->getSensorPose();
+
+	// Aggregate the scan's points per cell first, so the entry holds one
+	// contribution per cell that can be subtracted on re-integration
+	std::map<VoxelKey, VoxelCell> local;
+	for(PointCloud::iterator p = cloud->begin(); p != cloud->end(); ++p)
+	{
+		Position pos = tf * Position(p->x, p->y, p->z);
+		VoxelKey key;
+		key.x = (int32_t)std::floor(pos[0] / mResolution);
+		key.y = (int32_t)std::floor(pos[1] / mResolution);
+		key.z = (int32_t)std::floor(pos[2] / mResolution);
+		VoxelCell& cell = local[key];
+		cell.x += pos[0];
+		cell.y += pos[1];
+		cell.z += pos[2];
+		cell.count++;
+	}
+
+	VertexEntry entry;
+	entry.pose = vertex.corrected_pose;
+	entry.contributions.reserve(local.size());
+	for(std::map<VoxelKey, VoxelCell>::iterator it = local.begin(); it != local.end(); ++it)
+	{
+		VoxelCell& cell = mGrid[it->first];
+		cell.x += it->second.x;
+		cell.y += it->second.y;
+		cell.z += it->second.z;
+		cell.count += it->second.count;
+		entry.contributions.push_back(*it);
+	}
+	mVertices[vertex.index] = entry;
+}
+
+void IncrementalMap::removeContributions(const VertexEntry& entry)
+{
+	for(std::vector< std::pair<VoxelKey, VoxelCell> >::const_iterator it = entry.contributions.begin();
+	    it != entry.contributions.end(); ++it)
+	{
+		VoxelGrid::iterator cell = mGrid.find(it->first);
+		if(cell == mGrid.end())
+			continue;
+		cell->second.x -= it->second.x;
+		cell->second.y -= it->second.y;
+		cell->second.z -= it->second.z;
+		cell->second.count -= it->second.count;
+		if(cell->second.count == 0)
+		{
+			mGrid.erase(cell);
+		}
+	}
+}
+
+PointCloud::Ptr IncrementalMap::getPointCloud()
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	PointCloud::Ptr cloud(new PointCloud);
+	cloud->reserve(mGrid.size());
+	for(VoxelGrid::iterator it = mGrid.begin(); it != mGrid.end(); ++it)
+	{
+		if(it->second.count < mMinObservations)
+			continue;
+		PointType p;
+		p.x = it->second.x / it->second.count;
+		p.y = it->second.y / it->second.count;
+		p.z = it->second.z / it->second.count;
+		cloud->push_back(p);
+	}
+	return cloud;
+}
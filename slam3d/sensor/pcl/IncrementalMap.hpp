@@ -0,0 +1,151 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM_INCREMENTALMAP_HPP
+#define SLAM_INCREMENTALMAP_HPP
+
+#include <slam3d/sensor/pcl/PointCloudSensor.hpp>
+
+#include <unordered_map>
+
+namespace slam3d
+{
+	/**
+	 * @class IncrementalMap
+	 * @brief Voxel-hash map that is updated per vertex instead of being
+	 * rebuilt from scratch.
+	 * @details Alternative to PointCloudSensor::buildMap(), which
+	 * re-accumulates every scan, filters the whole map and downsamples it
+	 * whenever an updated map is requested. The incremental map keeps a
+	 * hash of voxel cells: a new vertex only integrates its own scan, and
+	 * after an optimization only the vertices whose corrected pose moved
+	 * beyond a threshold are re-integrated. Map publication therefore
+	 * costs proportional to what changed, not to the mission size.
+	 */
+	class IncrementalMap
+	{
+	public:
+		/**
+		 * @brief Constructor
+		 * @param logger pointer to a Logger to write messages
+		 * @param resolution edge length of the voxel cells
+		 */
+		IncrementalMap(Logger* logger, double resolution);
+
+		/**
+		 * @brief Set the pose change that triggers re-integration.
+		 * @details Vertices whose corrected pose moved less than this
+		 * since they were integrated keep their cells, so small
+		 * corrections do not cause a full rebuild.
+		 * @param translation
+		 * @param rotation
+		 */
+		void setUpdateThreshold(double translation, double rotation);
+
+		/**
+		 * @brief Require a minimum number of points per occupied cell.
+		 * @details Cells observed fewer times are left out of the
+		 * published cloud, which removes stray points similar to the
+		 * outlier filtering of buildMap().
+		 * @param n
+		 */
+		void setMinObservations(unsigned n);
+
+		/**
+		 * @brief Bring the map up to date with the given vertices.
+		 * @details Integrates scans of new vertices and re-integrates
+		 * those whose pose changed beyond the update threshold; all
+		 * others are skipped with a cheap pose comparison.
+		 * @param vertices current vertices of the point cloud sensor
+		 */
+		void update(const VertexObjectList& vertices);
+
+		/**
+		 * @brief Assemble the current map as a point cloud.
+		 * @details Each occupied cell contributes the centroid of its
+		 * integrated points.
+		 */
+		PointCloud::Ptr getPointCloud();
+
+	private:
+		struct VoxelKey
+		{
+			int32_t x, y, z;
+
+			bool operator==(const VoxelKey& other) const
+			{
+				return x == other.x && y == other.y && z == other.z;
+			}
+
+			bool operator<(const VoxelKey& other) const
+			{
+				if(x != other.x) return x < other.x;
+				if(y != other.y) return y < other.y;
+				return z < other.z;
+			}
+		};
+
+		struct VoxelKeyHash
+		{
+			std::size_t operator()(const VoxelKey& k) const
+			{
+				return (k.x * 73856093) ^ (k.y * 19349663) ^ (k.z * 83492791);
+			}
+		};
+
+		// Sum and count of the points that fell into a cell, so point
+		// contributions can be subtracted again on re-integration
+		struct VoxelCell
+		{
+			VoxelCell() : x(0), y(0), z(0), count(0) {}
+			double x, y, z;
+			unsigned count;
+		};
+
+		typedef std::unordered_map<VoxelKey, VoxelCell, VoxelKeyHash> VoxelGrid;
+
+		// The pose a vertex was integrated with and the cells it filled
+		struct VertexEntry
+		{
+			Transform pose;
+			std::vector< std::pair<VoxelKey, VoxelCell> > contributions;
+		};
+
+		void integrate(const VertexObject& vertex);
+		void removeContributions(const VertexEntry& entry);
+
+		Logger* mLogger;
+		double mResolution;
+		double mUpdateTranslation;
+		double mUpdateRotation;
+		unsigned mMinObservations;
+
+		VoxelGrid mGrid;
+		std::map<IdType, VertexEntry> mVertices;
+		std::mutex mMutex;
+	};
+}
+
+#endif
@@ -29,14 +29,27 @@
 
 #include <pclomp/gicp_omp.h>
 #include <pclomp/ndt_omp.h>
+#ifdef SLAM3D_GPU_REGISTRATION
+#include <fast_gicp/gicp/fast_vgicp_cuda.hpp>
+#include <fast_gicp/ndt/ndt_cuda.hpp>
+#endif
 #include <pcl/filters/voxel_grid.h>
 #include <pcl/filters/radius_outlier_removal.h>
+#include <pcl/octree/octree_pointcloud_changedetector.h>
 #include <pcl/pcl_config.h>
 #include <pcl/sample_consensus/ransac.h>
 #include <pcl/sample_consensus/sac_model_plane.h>
 
 #include <boost/format.hpp>
 
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #define PI 3.141592654
 
 using namespace slam3d;
@@ -47,6 +60,13 @@ PointCloudSensor::PointCloudSensor(const std::string& n, Logger* l)
 	mMapResolution = 0.1;
 	mMapOutlierRadius = 0.2;
 	mMapOutlierNeighbors = 3;
+	mMotionGateResolution = 0;
+	mMotionGateThreshold = 0.1;
+	mRegistrationCacheSize = 0;
+	mCascadeExitTranslation = 0;
+	mCascadeExitRotation = 0;
+	mUseRollingPatch = false;
+	mRollingPoseRevision = 0;
 }
 
 PointCloudSensor::~PointCloudSensor()
@@ -67,6 +87,89 @@ PointCloud::Ptr PointCloudSensor::downsample(PointCloud::ConstPtr in, double lea
 	return out;
 }
 
+namespace
+{
+	// Single pass over the cloud into an open-addressing voxel hash with a
+	// running mean per cell; avoids the sorting done by pcl::VoxelGrid.
+	PointCloud::Ptr approximateVoxelFilter(PointCloud::ConstPtr in, double leaf_size)
+	{
+		PointCloud::Ptr out(new PointCloud);
+		if(in->size() == 0)
+			return out;
+
+		// Voxel cell in the table; count == 0 marks a free slot
+		struct Cell
+		{
+			uint64_t key;
+			float x, y, z;
+			uint32_t count;
+		};
+
+		// Sized so the table stays at most half full with one cell per point
+		std::size_t capacity = 1;
+		while(capacity < in->size() * 2)
+			capacity <<= 1;
+		std::vector<Cell> cells(capacity);
+		const std::size_t mask = capacity - 1;
+
+		for(PointCloud::const_iterator p = in->begin(); p != in->end(); ++p)
+		{
+			// 21 bits per axis, enough for ~10^6 cells in each direction
+			uint64_t cx = (uint64_t)(int64_t)std::floor(p->x / leaf_size) & 0x1FFFFF;
+			uint64_t cy = (uint64_t)(int64_t)std::floor(p->y / leaf_size) & 0x1FFFFF;
+			uint64_t cz = (uint64_t)(int64_t)std::floor(p->z / leaf_size) & 0x1FFFFF;
+			uint64_t key = (cx << 42) | (cy << 21) | cz;
+
+			std::size_t slot = ((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+			while(cells[slot].count > 0 && cells[slot].key != key)
+				slot = (slot + 1) & mask;
+
+			// Running mean, so the cell position does not drift with
+			// large coordinates the way a plain float sum would
+			Cell& cell = cells[slot];
+			cell.key = key;
+			cell.count++;
+			cell.x += (p->x - cell.x) / cell.count;
+			cell.y += (p->y - cell.y) / cell.count;
+			cell.z += (p->z - cell.z) / cell.count;
+		}
+
+		for(std::vector<Cell>::iterator it = cells.begin(); it != cells.end(); ++it)
+		{
+			if(it->count == 0)
+				continue;
+			PointType p;
+			p.x = it->x;
+			p.y = it->y;
+			p.z = it->z;
+			out->push_back(p);
+		}
+		return out;
+	}
+}
+
+const PointCloud::Ptr PointCloudMeasurement::getApproximatePointCloud(double density) const
+{
+	if(density <= 0)
+		return getPointCloud();
+
+	std::lock_guard<std::mutex> guard(mLevelMutex);
+	std::map<double, PointCloud::Ptr>::const_iterator it = mApproxLevels.find(density);
+	if(it != mApproxLevels.end())
+		return it->second;
+
+	std::lock_guard<std::mutex> payload_guard(mPayloadMutex);
+	fetchPayload();
+	PointCloud::Ptr level = approximateVoxelFilter(mPointCloud, density);
+	mApproxLevels[density] = level;
+	return level;
+}
+
+PointCloud::Ptr PointCloudSensor::downsampleApprox(PointCloud::ConstPtr in, double leaf_size) const
+{
+	return approximateVoxelFilter(in, leaf_size);
+}
+
 PointCloud::Ptr PointCloudSensor::removeOutliers(PointCloud::ConstPtr in, double radius, unsigned min_neighbors) const
 {
 	PointCloud::Ptr out(new PointCloud);
@@ -88,20 +191,61 @@ PointCloud::Ptr PointCloudSensor::transform(PointCloud::ConstPtr source, const T
 	return transformedCloud;
 }
 
-PointCloud::Ptr PointCloudSensor::getAccumulatedCloud(const VertexObjectList& vertices) const
+PointCloud::Ptr PointCloudSensor::getAccumulatedCloud(const VertexObjectList& vertices, double density) const
 {
-	PointCloud::Ptr accu(new PointCloud);
+	// Gather the clouds and each one's slice in the output first, so the
+	// accumulator is allocated exactly once
+	std::vector<PointCloud::Ptr> clouds;
+	std::vector<Transform> poses;
+	std::vector<std::size_t> offsets;
+	clouds.reserve(vertices.size());
+	poses.reserve(vertices.size());
+	offsets.reserve(vertices.size());
+	std::size_t total = 0;
 	for(VertexObjectList::const_reverse_iterator it = vertices.rbegin(); it != vertices.rend(); it++)
 	{
-		PointCloudMeasurement::Ptr pcl = boost::dynamic_pointer_cast<PointCloudMeasurement>(it->measurement);
+		PointCloudMeasurement::Ptr pcl = std::dynamic_pointer_cast<PointCloudMeasurement>(it->measurement);
 		if(!pcl)
 		{
 			mLogger->message(ERROR, "Measurement in getAccumulatedCloud() is not a point cloud!");
 			throw BadMeasurementType();
 		}
-		
-		PointCloud::Ptr tempCloud = transform(pcl->getPointCloud(), (it->corrected_pose * pcl->getSensorPose()));
-		*accu += *tempCloud;
+		clouds.push_back(pcl->getPointCloud(density));
+		poses.push_back(it->corrected_pose * pcl->getSensorPose());
+		offsets.push_back(total);
+		total += clouds.back()->size();
+	}
+
+	PointCloud::Ptr accu(new PointCloud);
+	accu->resize(total);
+
+	// The per-vertex transforms are independent, so the workers write
+	// each cloud directly into its slice without temporaries
+	unsigned threads = std::min<std::size_t>(clouds.size(), std::max(1u, std::thread::hardware_concurrency()));
+	std::atomic<std::size_t> next(0);
+	std::vector<std::thread> workers;
+	for(unsigned w = 0; w < threads; w++)
+	{
+		workers.push_back(std::thread([&]()
+		{
+			for(std::size_t i = next++; i < clouds.size(); i = next++)
+			{
+				const Eigen::Matrix4f tf = poses[i].matrix().cast<float>();
+				const PointCloud& in = *clouds[i];
+				PointType* out = &accu->points[offsets[i]];
+				for(std::size_t j = 0; j < in.size(); j++)
+				{
+					const PointType& p = in[j];
+					out[j].x = tf(0,0)*p.x + tf(0,1)*p.y + tf(0,2)*p.z + tf(0,3);
+					out[j].y = tf(1,0)*p.x + tf(1,1)*p.y + tf(1,2)*p.z + tf(1,3);
+					out[j].z = tf(2,0)*p.x + tf(2,1)*p.y + tf(2,2)*p.z + tf(2,3);
+				}
+			}
+		}));
+	}
+	for(std::vector<std::thread>::iterator w = workers.begin(); w != workers.end(); ++w)
+	{
+		w->join();
 	}
 	return accu;
 }
@@ -117,6 +261,133 @@ Measurement::Ptr PointCloudSensor::createCombinedMeasurement(const VertexObjectL
 }
 
 
+void PointCloudSensor::setMotionGate(double resolution, double threshold)
+{
+	mLogger->message(INFO, (boost::format("motion_gate_resolution: %1%") % resolution).str());
+	mLogger->message(INFO, (boost::format("motion_gate_threshold:  %1%") % threshold).str());
+	mMotionGateResolution = resolution;
+	mMotionGateThreshold = threshold;
+}
+
+bool PointCloudSensor::detectMotion(const Measurement::Ptr& source, const Measurement::Ptr& target)
+{
+	if(mMotionGateResolution <= 0)
+		return true;
+
+	PointCloudMeasurement::Ptr sourceCloud = std::dynamic_pointer_cast<PointCloudMeasurement>(source);
+	PointCloudMeasurement::Ptr targetCloud = std::dynamic_pointer_cast<PointCloudMeasurement>(target);
+	if(!sourceCloud || !targetCloud || targetCloud->getPointCloud()->empty())
+		return true;
+
+	// Count how many points of the new scan fall into voxels that were
+	// empty in the last scan. A stationary robot sees (almost) only
+	// occupied voxels, so the expensive registration can be skipped.
+	pcl::octree::OctreePointCloudChangeDetector<PointType> detector(mMotionGateResolution);
+	detector.setInputCloud(sourceCloud->getPointCloud());
+	detector.addPointsFromInputCloud();
+	detector.switchBuffers();
+	detector.setInputCloud(targetCloud->getPointCloud());
+	detector.addPointsFromInputCloud();
+
+	std::vector<int> novel;
+	detector.getPointIndicesFromNewVoxels(novel);
+	double ratio = (double)novel.size() / targetCloud->getPointCloud()->size();
+	mLogger->message(DEBUG, (boost::format("Motion gate: %1% %% of the scan is novel.") % (ratio * 100)).str());
+	return ratio >= mMotionGateThreshold;
+}
+
+void PointCloudSensor::setRollingPatch(bool enable)
+{
+	mLogger->message(INFO, (boost::format("rolling_patch:          %1%") % enable).str());
+	std::lock_guard<std::mutex> guard(mRollingMutex);
+	mUseRollingPatch = enable;
+	mRollingSegments.clear();
+}
+
+void PointCloudSensor::onVertexAdded(IdType vertex)
+{
+	// Generate the configured density levels once at insertion, so the
+	// matching hot path finds them precomputed
+	if(!mDownsamplingLevels.empty())
+	{
+		PointCloudMeasurement::Ptr m = std::dynamic_pointer_cast<PointCloudMeasurement>(
+			mMapper->getGraph()->getVertex(vertex).measurement);
+		if(m)
+		{
+			for(double density : mDownsamplingLevels)
+			{
+				m->getPointCloud(density);
+			}
+		}
+	}
+
+	if(!mUseRollingPatch)
+		return;
+
+	VertexObject obj = mMapper->getGraph()->getVertex(vertex);
+	PointCloudMeasurement::Ptr pcl = std::dynamic_pointer_cast<PointCloudMeasurement>(obj.measurement);
+	if(!pcl)
+	{
+		mLogger->message(ERROR, "Measurement in onVertexAdded() is not a point cloud!");
+		return;
+	}
+
+	// Transform the new scan into the map frame once; the accumulated
+	// patch is then assembled from these segments without touching the
+	// older scans again.
+	std::lock_guard<std::mutex> guard(mRollingMutex);
+	mRollingSegments.push_back(std::make_pair(vertex,
+		transform(pcl->getPointCloud(), obj.corrected_pose * pcl->getSensorPose())));
+	while(mRollingSegments.size() > getPatchBuildingRange() + 1)
+	{
+		mRollingSegments.pop_front();
+	}
+	mRollingPoseRevision = mMapper->getGraph()->getPoseRevision();
+}
+
+void PointCloudSensor::refreshRollingPatch()
+{
+	for(auto& segment : mRollingSegments)
+	{
+		VertexObject obj = mMapper->getGraph()->getVertex(segment.first);
+		PointCloudMeasurement::Ptr pcl = std::dynamic_pointer_cast<PointCloudMeasurement>(obj.measurement);
+		segment.second = transform(pcl->getPointCloud(), obj.corrected_pose * pcl->getSensorPose());
+	}
+	mRollingPoseRevision = mMapper->getGraph()->getPoseRevision();
+}
+
+Measurement::Ptr PointCloudSensor::buildPatch(IdType source)
+{
+	std::unique_lock<std::mutex> lock(mRollingMutex);
+	if(!mUseRollingPatch || getPatchBuildingRange() == 0 ||
+	   mRollingSegments.empty() || mRollingSegments.back().first != source)
+	{
+		lock.unlock();
+		return ScanSensor::buildPatch(source);
+	}
+
+	// An optimization may have moved the poses since the segments were
+	// transformed; in that case they have to be refreshed first.
+	if(mRollingPoseRevision != mMapper->getGraph()->getPoseRevision())
+	{
+		refreshRollingPatch();
+	}
+
+	PointCloud::Ptr accu(new PointCloud);
+	for(auto& segment : mRollingSegments)
+	{
+		*accu += *(segment.second);
+	}
+
+	// Shift the accumulated cloud into the frame of the source vertex
+	Transform pose = mMapper->getGraph()->getVertex(source).corrected_pose;
+	PointCloud::Ptr shifted(new PointCloud);
+	pcl::transformPointCloud(*accu, *shifted, pose.inverse().matrix());
+	mLogger->message(DEBUG, (boost::format("Rolling patch has %1% points from %2% scans.")
+	 % shifted->size() % mRollingSegments.size()).str());
+	return std::make_shared<PointCloudMeasurement>(shifted, "AccumulatedPointcloud", mName, Transform::Identity());
+}
+
 Constraint::Ptr PointCloudSensor::createConstraint(const Measurement::Ptr& source,
                                                    const Measurement::Ptr& target,
                                                    const Transform& odometry, bool loop)
@@ -125,23 +396,55 @@ Constraint::Ptr PointCloudSensor::createConstraint(const Measurement::Ptr& sourc
 	Transform guess = source->getInverseSensorPose() * odometry * target->getSensorPose();
 	
 	// Cast to this sensors measurement type
-	PointCloudMeasurement::Ptr sourceCloud = boost::dynamic_pointer_cast<PointCloudMeasurement>(source);
-	PointCloudMeasurement::Ptr targetCloud = boost::dynamic_pointer_cast<PointCloudMeasurement>(target);
+	PointCloudMeasurement::Ptr sourceCloud = std::dynamic_pointer_cast<PointCloudMeasurement>(source);
+	PointCloudMeasurement::Ptr targetCloud = std::dynamic_pointer_cast<PointCloudMeasurement>(target);
 	if(!sourceCloud || !targetCloud)
 	{
 		mLogger->message(ERROR, "Measurement given to createConstraint() is not a PointCloud!");
 		throw BadMeasurementType();
 	}
 	
-	// For large loops, refine guess by a coarse ICP
-	if(loop)
+	// Draw this registration's threads from the shared budget; sequential
+	// matches and loop closures are accounted separately, so a configured
+	// reservation keeps the ingestion path responsive.
+	ThreadBudget::Lease lease(mThreadBudget, loop ? TASK_LOOP_CLOSURE : TASK_MATCHING,
+	                          std::max(1u, std::thread::hardware_concurrency()));
+
+	Transform icp_result;
+	if(!mRegistrationCascade.empty())
+	{
+		// Walk down the cascade, each level seeded by the previous one.
+		// When a level barely changes the estimate, the match has
+		// converged and the finer levels are skipped.
+		icp_result = guess;
+		for(std::vector<RegistrationParameters>::iterator level = mRegistrationCascade.begin(); level != mRegistrationCascade.end(); ++level)
+		{
+			Transform seed = icp_result;
+			icp_result = align(sourceCloud, targetCloud, seed, *level, lease.threads());
+
+			Transform diff = seed.inverse() * icp_result;
+			ScalarType angle = Eigen::AngleAxis<ScalarType>(diff.rotation()).angle();
+			if(mCascadeExitTranslation > 0 && mCascadeExitRotation > 0 &&
+			   diff.translation().norm() < mCascadeExitTranslation &&
+			   std::abs(angle) < mCascadeExitRotation)
+			{
+				mLogger->message(DEBUG, (boost::format("Cascade converged after level %1%.")
+				 % (level - mRegistrationCascade.begin() + 1)).str());
+				break;
+			}
+		}
+	}else
 	{
-		guess = align(sourceCloud, targetCloud, guess, mCoarseConfiguration);
+		// For large loops, refine guess by a coarse ICP
+		if(loop)
+		{
+			guess = align(sourceCloud, targetCloud, guess, mCoarseConfiguration, lease.threads());
+		}
+
+		// Calculate precise alignement with fine ICP
+		icp_result = align(sourceCloud, targetCloud, guess, mFineConfiguration, lease.threads());
 	}
-	
-	// Calculate precise alignement with fine ICP
-	Transform icp_result = align(sourceCloud, targetCloud, guess, mFineConfiguration);
-	
+
 	// Transform back to robot frame
 	Transform transform = source->getSensorPose() * icp_result * target->getInverseSensorPose();
 	Covariance<6> covariance = Covariance<6>::Identity() * mCovarianceScale;
@@ -149,48 +452,225 @@ Constraint::Ptr PointCloudSensor::createConstraint(const Measurement::Ptr& sourc
 	return Constraint::Ptr(new SE3Constraint(mName, transform, covariance.inverse()));
 }
 
+void PointCloudSensor::setDownsamplingLevels(const std::vector<double>& densities)
+{
+	mLogger->message(INFO, (boost::format("downsampling_levels:    %1%") % densities.size()).str());
+	mDownsamplingLevels = densities;
+}
+
+void PointCloudSensor::setRegistrationCascade(const std::vector<RegistrationParameters>& levels,
+                                              double exit_translation, double exit_rotation)
+{
+	mLogger->message(INFO, (boost::format("registration_cascade:   %1% levels") % levels.size()).str());
+	mRegistrationCascade = levels;
+	mCascadeExitTranslation = exit_translation;
+	mCascadeExitRotation = exit_rotation;
+}
+
+void PointCloudSensor::setRegistrationCache(unsigned size)
+{
+	mLogger->message(INFO, (boost::format("registration_cache:     %1%") % size).str());
+	std::lock_guard<std::mutex> guard(mRegistrationCacheMutex);
+	mRegistrationCacheSize = size;
+	while(mRegistrationCache.size() > mRegistrationCacheSize)
+	{
+		mRegistrationCache.pop_back();
+	}
+}
+
 Transform PointCloudSensor::align(PointCloudMeasurement::Ptr source,
                                   PointCloudMeasurement::Ptr target,
                                   const Transform& guess,
-                                  const RegistrationParameters& config)
+                                  const RegistrationParameters& config,
+                                  unsigned threads)
 {
-	// Downsample the scans
-	PointCloud::Ptr filtered_source = source->getPointCloud();
-	PointCloud::Ptr filtered_target = target->getPointCloud();
-	if(config.point_cloud_density > 0)
+	// The levels are retained by the measurements, so the same scan is
+	// only voxel-filtered once per density over its lifetime
+	PointCloud::Ptr filtered_target;
+	if(config.approximate_downsampling)
+		filtered_target = target->getApproximatePointCloud(config.point_cloud_density);
+	else
+		filtered_target = target->getPointCloud(config.point_cloud_density);
+
+	// Resolve the effective algorithm; without GPU support in the build,
+	// the GPU variants run their CPU counterpart instead of failing.
+	RegistrationAlgorithm algorithm = config.registration_algorithm;
+#ifndef SLAM3D_GPU_REGISTRATION
+	if(algorithm == GICP_GPU || algorithm == NDT_GPU)
 	{
-		PointCloud::Ptr filtered_source = downsample(source->getPointCloud(), config.point_cloud_density);
-		PointCloud::Ptr filtered_target = downsample(target->getPointCloud(), config.point_cloud_density);
+		mLogger->message(ERROR, "Built without SLAM3D_GPU_REGISTRATION, using the CPU counterpart.");
+		algorithm = (algorithm == GICP_GPU) ? GICP : NDT;
 	}
-	
+#endif
+
+	// The registration indexes the source measurement's cloud, which the
+	// sequential path and retried loop closures reuse across calls. Look
+	// up the structures built for it in a previous registration. A hit is
+	// checked out of the cache, as the registration object is stateful
+	// and must not be shared between concurrent link jobs.
+	RegistrationPtr registration;
+	PointCloud::Ptr filtered_source;
+	if(mRegistrationCacheSize > 0)
+	{
+		std::lock_guard<std::mutex> guard(mRegistrationCacheMutex);
+		for(std::list<RegistrationCacheEntry>::iterator it = mRegistrationCache.begin(); it != mRegistrationCache.end(); ++it)
+		{
+			if(it->uuid == source->getUniqueId() &&
+			   it->algorithm == algorithm &&
+			   it->density == config.point_cloud_density &&
+			   it->resolution == config.resolution)
+			{
+				registration = it->registration;
+				filtered_source = it->filtered;
+				mRegistrationCache.erase(it);
+				mLogger->message(DEBUG, "Reusing cached registration structures.");
+				break;
+			}
+		}
+	}
+
+	if(!filtered_source)
+	{
+		if(config.approximate_downsampling)
+			filtered_source = source->getApproximatePointCloud(config.point_cloud_density);
+		else
+			filtered_source = source->getPointCloud(config.point_cloud_density);
+	}
+
 	// Make sure that there are enough points left (ICP will crash if not)
 	if(filtered_target->size() < 100 || filtered_source->size() < 100)
 		throw NoMatch("Too few points after filtering, you may have to decrease 'point_cloud_density'.");
-	
-	// Configure Generalized-ICP
-	if(config.registration_algorithm == GICP)
+
+	if(!registration)
 	{
-		return doICP(filtered_source, filtered_target, guess, config);
-	}else
+		if(algorithm == GICP)
+		{
+			registration.reset(new pclomp::GeneralizedIterativeClosestPoint<PointType, PointType>);
+		}
+#ifdef SLAM3D_GPU_REGISTRATION
+		else if(algorithm == GICP_GPU)
+		{
+			registration.reset(new fast_gicp::FastVGICPCuda<PointType, PointType>);
+		}
+		else if(algorithm == NDT_GPU)
+		{
+			fast_gicp::NDTCuda<PointType, PointType>* ndt = new fast_gicp::NDTCuda<PointType, PointType>;
+			ndt->setResolution(config.resolution);
+			registration.reset(ndt);
+		}
+#endif
+		else
+		{
+			pclomp::NormalDistributionsTransform<PointType, PointType>* ndt =
+				new pclomp::NormalDistributionsTransform<PointType, PointType>;
+
+			// Set before the input, so the voxel grid is only built once
+			ndt->setResolution(config.resolution);
+			registration.reset(ndt);
+		}
+
+		// The kd-tree (and NDT's voxel grid) are built against this cloud
+		// and remain valid as long as it is not replaced. For the GPU
+		// variants this is the upload to the device: the cloud stays
+		// resident there for every later call through the cache, e.g.
+		// across the stages of one constraint when they share a density.
+		registration->setInputTarget(filtered_source);
+	}
+
+	// Bound the parallelism of this registration by the granted budget.
+	// omp_set_num_threads() only changes the calling thread's setting,
+	// so concurrent link jobs do not interfere with each other.
+	if(threads > 0)
+	{
+#ifdef _OPENMP
+		omp_set_num_threads(threads);
+#endif
+		std::shared_ptr< pclomp::NormalDistributionsTransform<PointType, PointType> > ndt =
+			std::dynamic_pointer_cast< pclomp::NormalDistributionsTransform<PointType, PointType> >(registration);
+		if(ndt)
+		{
+			ndt->setNumThreads(threads);
+		}
+	}
+
+	// Return the structures to the cache even when the match fails, a
+	// retry against the same measurement is likely.
+	Transform result;
+	try
 	{
-		return doNDT(filtered_source, filtered_target, guess, config);
+		if(algorithm == GICP)
+		{
+			result = doICP(registration, filtered_target, guess, config);
+		}
+		else if(algorithm == GICP_GPU || algorithm == NDT_GPU)
+		{
+			result = doGPU(registration, filtered_target, guess, config);
+		}
+		else
+		{
+			result = doNDT(registration, filtered_target, guess, config);
+		}
+	}catch(NoMatch &e)
+	{
+		storeRegistration(source->getUniqueId(), algorithm, config, filtered_source, registration);
+		throw;
+	}
+	storeRegistration(source->getUniqueId(), algorithm, config, filtered_source, registration);
+	return result;
+}
+
+void PointCloudSensor::storeRegistration(const boost::uuids::uuid& uuid,
+                                         RegistrationAlgorithm algorithm,
+                                         const RegistrationParameters& config,
+                                         PointCloud::Ptr filtered,
+                                         RegistrationPtr registration)
+{
+	if(mRegistrationCacheSize == 0)
+		return;
+
+	std::lock_guard<std::mutex> guard(mRegistrationCacheMutex);
+
+	// Another job may have built the same structures in the meantime
+	for(std::list<RegistrationCacheEntry>::iterator it = mRegistrationCache.begin(); it != mRegistrationCache.end(); ++it)
+	{
+		if(it->uuid == uuid &&
+		   it->algorithm == algorithm &&
+		   it->density == config.point_cloud_density &&
+		   it->resolution == config.resolution)
+		{
+			return;
+		}
+	}
+
+	RegistrationCacheEntry entry;
+	entry.uuid = uuid;
+	entry.algorithm = algorithm;
+	entry.density = config.point_cloud_density;
+	entry.resolution = config.resolution;
+	entry.filtered = filtered;
+	entry.registration = registration;
+	mRegistrationCache.push_front(entry);
+	while(mRegistrationCache.size() > mRegistrationCacheSize)
+	{
+		mRegistrationCache.pop_back();
 	}
 }
 
-Transform PointCloudSensor::doICP(PointCloud::Ptr source,
+Transform PointCloudSensor::doICP(RegistrationPtr registration,
                                   PointCloud::Ptr target,
                                   const Transform& guess,
                                   const RegistrationParameters& config)
 {
-	pclomp::GeneralizedIterativeClosestPoint<PointType, PointType> icp;
-	icp.setMaxCorrespondenceDistance(config.max_correspondence_distance);
-	icp.setMaximumIterations(config.maximum_iterations);
-	icp.setTransformationEpsilon(config.transformation_epsilon);
-	icp.setEuclideanFitnessEpsilon(config.euclidean_fitness_epsilon);
-	icp.setCorrespondenceRandomness(config.correspondence_randomness);
-	icp.setMaximumOptimizerIterations(config.maximum_optimizer_iterations);
-	icp.setRotationEpsilon(config.rotation_epsilon);
-	
+	std::shared_ptr< pclomp::GeneralizedIterativeClosestPoint<PointType, PointType> > icp =
+		std::dynamic_pointer_cast< pclomp::GeneralizedIterativeClosestPoint<PointType, PointType> >(registration);
+	icp->setMaxCorrespondenceDistance(config.max_correspondence_distance);
+	icp->setMaximumIterations(config.maximum_iterations);
+	icp->setTransformationEpsilon(config.transformation_epsilon);
+	icp->setEuclideanFitnessEpsilon(config.euclidean_fitness_epsilon);
+	icp->setCorrespondenceRandomness(config.correspondence_randomness);
+	icp->setMaximumOptimizerIterations(config.maximum_optimizer_iterations);
+	icp->setRotationEpsilon(config.rotation_epsilon);
+
 	PointCloud result;
 
 #if PCL_VERSION_COMPARE(<, 1, 8, 1)
@@ -200,77 +680,272 @@ Transform PointCloudSensor::doICP(PointCloud::Ptr source,
 	// > https://github.com/PointCloudLibrary/pcl/pull/989
 	PointCloud::Ptr shifted_target(new PointCloud);
 	pcl::transformPointCloud(*target, *shifted_target, guess.matrix());
-	
+
 	// Source and target are switched at this point!
 	// In the pose graph, our edge (with transform) goes from source to target,
 	// but ICP calculates the transformation from target to source.
-	icp.setInputSource(shifted_target);
-	icp.setInputTarget(source);
-	icp.align(result);
+	icp->setInputSource(shifted_target);
+	icp->align(result);
 #else
-	icp.setInputSource(target);
-	icp.setInputTarget(source);
-	icp.align(result, guess.matrix().cast<float>());
+	icp->setInputSource(target);
+	icp->align(result, guess.matrix().cast<float>());
 #endif
 
 	// Check if ICP was successful (kind of...)
-	double score = icp.getFitnessScore(config.max_correspondence_distance);
-	if(!icp.hasConverged() || score > config.max_fitness_score)
+	double score = icp->getFitnessScore(config.max_correspondence_distance);
+	if(!icp->hasConverged() || score > config.max_fitness_score)
 	{
 		throw NoMatch((boost::format("ICP failed with Fitness-Score %1% > %2%") % score % config.max_fitness_score).str());
 	}
-	
+
 	// Get estimated transform
-	Transform icp_result(Eigen::Isometry3f(icp.getFinalTransformation()));
+	Transform icp_result(Eigen::Isometry3f(icp->getFinalTransformation()));
 #if PCL_VERSION_COMPARE(<, 1, 8, 1)
 	icp_result = icp_result * guess;
 #endif
 	return icp_result;
 }
 
-Transform PointCloudSensor::doNDT(PointCloud::Ptr source,
+Transform PointCloudSensor::doNDT(RegistrationPtr registration,
                                   PointCloud::Ptr target,
                                   const Transform& guess,
                                   const RegistrationParameters& config)
 {
-	pclomp::NormalDistributionsTransform<PointType, PointType> ndt;
-	ndt.setMaxCorrespondenceDistance(config.max_correspondence_distance);
-	ndt.setMaximumIterations(config.maximum_iterations);
-	ndt.setTransformationEpsilon(config.transformation_epsilon);
-	ndt.setEuclideanFitnessEpsilon(config.euclidean_fitness_epsilon);
-	ndt.setOutlierRatio(config.outlier_ratio);
-	ndt.setStepSize(config.step_size);
-	ndt.setResolution(config.resolution);
-	
+	std::shared_ptr< pclomp::NormalDistributionsTransform<PointType, PointType> > ndt =
+		std::dynamic_pointer_cast< pclomp::NormalDistributionsTransform<PointType, PointType> >(registration);
+	ndt->setMaxCorrespondenceDistance(config.max_correspondence_distance);
+	ndt->setMaximumIterations(config.maximum_iterations);
+	ndt->setTransformationEpsilon(config.transformation_epsilon);
+	ndt->setEuclideanFitnessEpsilon(config.euclidean_fitness_epsilon);
+	ndt->setOutlierRatio(config.outlier_ratio);
+	ndt->setStepSize(config.step_size);
+	ndt->setResolution(config.resolution);
+
 	// Source and target are switched at this point!
 	// In the pose graph, our edge (with transform) goes from source to target,
 	// but ICP calculates the transformation from target to source.
-	ndt.setInputSource(target);
-	ndt.setInputTarget(source);
+	ndt->setInputSource(target);
 	PointCloud result;
-	ndt.align(result, guess.matrix().cast<float>());
+	ndt->align(result, guess.matrix().cast<float>());
 
 	// Check if NDT was successful (kind of...)
-	double score = ndt.getFitnessScore(config.max_correspondence_distance);
+	double score = ndt->getFitnessScore(config.max_correspondence_distance);
 	mLogger->message(DEBUG, (boost::format("NDT: fitness(%1%) probability(%2%) iterations(%3%)")
-		%score % ndt.getTransformationProbability() % ndt.getFinalNumIteration()).str());
-	if(!ndt.hasConverged() || score > config.max_fitness_score)
+		%score % ndt->getTransformationProbability() % ndt->getFinalNumIteration()).str());
+	if(!ndt->hasConverged() || score > config.max_fitness_score)
 	{
 		throw NoMatch((boost::format("NDT failed with Fitness-Score %1% > %2%") % score % config.max_fitness_score).str());
 	}
-	
+
+	// Get estimated transform
+	Eigen::Isometry3f tf_matrix(ndt->getFinalTransformation());
+	return Transform(tf_matrix);
+}
+
+Transform PointCloudSensor::doGPU(RegistrationPtr registration,
+                                  PointCloud::Ptr target,
+                                  const Transform& guess,
+                                  const RegistrationParameters& config)
+{
+	// The GPU methods are configured through the common interface; their
+	// grid resolution is fixed at creation, like pclomp's NDT
+	registration->setMaxCorrespondenceDistance(config.max_correspondence_distance);
+	registration->setMaximumIterations(config.maximum_iterations);
+	registration->setTransformationEpsilon(config.transformation_epsilon);
+	registration->setEuclideanFitnessEpsilon(config.euclidean_fitness_epsilon);
+
+	// Source and target are switched at this point!
+	// In the pose graph, our edge (with transform) goes from source to target,
+	// but ICP calculates the transformation from target to source.
+	registration->setInputSource(target);
+	PointCloud result;
+	registration->align(result, guess.matrix().cast<float>());
+
+	// Check if the match was successful
+	double score = registration->getFitnessScore(config.max_correspondence_distance);
+	mLogger->message(DEBUG, (boost::format("GPU: fitness(%1%)") % score).str());
+	if(!registration->hasConverged() || score > config.max_fitness_score)
+	{
+		throw NoMatch((boost::format("GPU registration failed with Fitness-Score %1% > %2%") % score % config.max_fitness_score).str());
+	}
+
 	// Get estimated transform
-	Eigen::Isometry3f tf_matrix(ndt.getFinalTransformation());
+	Eigen::Isometry3f tf_matrix(registration->getFinalTransformation());
 	return Transform(tf_matrix);
 }
 
 PointCloud::Ptr PointCloudSensor::buildMap(const VertexObjectList& vertices) const
 {
-	PointCloud::Ptr accu = getAccumulatedCloud(vertices);
+	// When the map resolution is a configured level, accumulate the
+	// precomputed clouds instead of the full-resolution ones; the final
+	// grid still merges the overlap between scans.
+	double density = 0;
+	for(double level : mDownsamplingLevels)
+	{
+		if(level == mMapResolution)
+			density = level;
+	}
+
+	PointCloud::Ptr accu = getAccumulatedCloud(vertices, density);
 	PointCloud::Ptr cleaned = removeOutliers(accu, mMapOutlierRadius, mMapOutlierNeighbors);
 	return downsample(cleaned, mMapResolution);
 }
 
+void PointCloudSensor::buildMapChunked(const VertexObjectList& vertices,
+                                       std::function<void(PointCloud::Ptr)> callback,
+                                       double chunk_size,
+                                       unsigned threads) const
+{
+	if(chunk_size <= 2 * mMapOutlierRadius)
+	{
+		mLogger->message(WARNING, "Chunk size must exceed twice the outlier radius, building the map in one piece.");
+		callback(buildMap(vertices));
+		return;
+	}
+
+	// Same level selection as buildMap()
+	double density = 0;
+	for(double level : mDownsamplingLevels)
+	{
+		if(level == mMapResolution)
+			density = level;
+	}
+
+	// Cubic grid cell a chunk covers; points within the outlier radius of
+	// a border are duplicated into the neighbor's halo, so filtering a
+	// chunk sees the same neighborhoods as a full-map pass would.
+	struct ChunkKey
+	{
+		int32_t x, y, z;
+		bool operator<(const ChunkKey& other) const
+		{
+			if(x != other.x) return x < other.x;
+			if(y != other.y) return y < other.y;
+			return z < other.z;
+		}
+	};
+
+	struct Chunk
+	{
+		ChunkKey key;
+		PointCloud::Ptr inner;
+		PointCloud::Ptr halo;
+	};
+
+	// Sort the transformed points directly into chunk buckets, so the
+	// full accumulated map is never materialized as one cloud
+	std::map<ChunkKey, std::size_t> index;
+	std::vector<Chunk> chunks;
+	for(VertexObjectList::const_reverse_iterator it = vertices.rbegin(); it != vertices.rend(); it++)
+	{
+		PointCloudMeasurement::Ptr pcl = std::dynamic_pointer_cast<PointCloudMeasurement>(it->measurement);
+		if(!pcl)
+		{
+			mLogger->message(ERROR, "Measurement in buildMapChunked() is not a point cloud!");
+			throw BadMeasurementType();
+		}
+		PointCloud::Ptr cloud = pcl->getPointCloud(density);
+		const Eigen::Matrix4f tf = (it->corrected_pose * pcl->getSensorPose()).matrix().cast<float>();
+		for(PointCloud::const_iterator p = cloud->begin(); p != cloud->end(); ++p)
+		{
+			PointType point;
+			point.x = tf(0,0)*p->x + tf(0,1)*p->y + tf(0,2)*p->z + tf(0,3);
+			point.y = tf(1,0)*p->x + tf(1,1)*p->y + tf(1,2)*p->z + tf(1,3);
+			point.z = tf(2,0)*p->x + tf(2,1)*p->y + tf(2,2)*p->z + tf(2,3);
+
+			ChunkKey key;
+			key.x = (int32_t)std::floor(point.x / chunk_size);
+			key.y = (int32_t)std::floor(point.y / chunk_size);
+			key.z = (int32_t)std::floor(point.z / chunk_size);
+
+			// Which neighbors the point also borders within the radius
+			int xs[2] = {0,0}, ys[2] = {0,0}, zs[2] = {0,0};
+			if(point.x - (key.x * chunk_size) < mMapOutlierRadius) xs[1] = -1;
+			else if(((key.x + 1) * chunk_size) - point.x < mMapOutlierRadius) xs[1] = 1;
+			if(point.y - (key.y * chunk_size) < mMapOutlierRadius) ys[1] = -1;
+			else if(((key.y + 1) * chunk_size) - point.y < mMapOutlierRadius) ys[1] = 1;
+			if(point.z - (key.z * chunk_size) < mMapOutlierRadius) zs[1] = -1;
+			else if(((key.z + 1) * chunk_size) - point.z < mMapOutlierRadius) zs[1] = 1;
+
+			for(int xi = 0; xi < 2; xi++) for(int yi = 0; yi < 2; yi++) for(int zi = 0; zi < 2; zi++)
+			{
+				if((xi > 0 && xs[xi] == 0) || (yi > 0 && ys[yi] == 0) || (zi > 0 && zs[zi] == 0))
+					continue;
+				ChunkKey target;
+				target.x = key.x + xs[xi];
+				target.y = key.y + ys[yi];
+				target.z = key.z + zs[zi];
+				std::map<ChunkKey, std::size_t>::iterator c = index.find(target);
+				if(c == index.end())
+				{
+					Chunk chunk;
+					chunk.key = target;
+					chunk.inner = PointCloud::Ptr(new PointCloud);
+					chunk.halo = PointCloud::Ptr(new PointCloud);
+					c = index.insert(std::make_pair(target, chunks.size())).first;
+					chunks.push_back(chunk);
+				}
+				if(xi == 0 && yi == 0 && zi == 0)
+					chunks[c->second].inner->push_back(point);
+				else
+					chunks[c->second].halo->push_back(point);
+			}
+		}
+	}
+	mLogger->message(DEBUG, (boost::format("Partitioned the map into %1% chunks of size %2%.")
+	 % chunks.size() % chunk_size).str());
+
+	// Filter the chunks in parallel; each finished chunk is handed to
+	// the callback right away, but never from two workers at once
+	if(threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min<std::size_t>(chunks.size(), threads);
+	std::atomic<std::size_t> next(0);
+	std::mutex emit_mutex;
+	std::vector<std::thread> workers;
+	for(unsigned w = 0; w < threads; w++)
+	{
+		workers.push_back(std::thread([&]()
+		{
+			for(std::size_t i = next++; i < chunks.size(); i = next++)
+			{
+				Chunk& chunk = chunks[i];
+				PointCloud::Ptr full(new PointCloud);
+				full->reserve(chunk.inner->size() + chunk.halo->size());
+				full->insert(full->end(), chunk.inner->begin(), chunk.inner->end());
+				full->insert(full->end(), chunk.halo->begin(), chunk.halo->end());
+				chunk.inner.reset();
+				chunk.halo.reset();
+
+				// Surviving halo points belong to the neighbor, so drop
+				// everything outside the chunk's own bounds afterwards
+				PointCloud::Ptr cleaned_full = removeOutliers(full, mMapOutlierRadius, mMapOutlierNeighbors);
+				full.reset();
+				PointCloud::Ptr cleaned(new PointCloud);
+				cleaned->reserve(cleaned_full->size());
+				for(PointCloud::const_iterator p = cleaned_full->begin(); p != cleaned_full->end(); ++p)
+				{
+					if(p->x >= chunk.key.x * chunk_size && p->x < (chunk.key.x + 1) * chunk_size &&
+					   p->y >= chunk.key.y * chunk_size && p->y < (chunk.key.y + 1) * chunk_size &&
+					   p->z >= chunk.key.z * chunk_size && p->z < (chunk.key.z + 1) * chunk_size)
+					{
+						cleaned->push_back(*p);
+					}
+				}
+				cleaned_full.reset();
+
+				PointCloud::Ptr result = downsample(cleaned, mMapResolution);
+				std::lock_guard<std::mutex> guard(emit_mutex);
+				callback(result);
+			}
+		}));
+	}
+	for(std::vector<std::thread>::iterator w = workers.begin(); w != workers.end(); ++w)
+	{
+		w->join();
+	}
+}
+
 void PointCloudSensor::setRegistrationParameters(const RegistrationParameters& conf, bool coarse)
 {
 	if(coarse)
@@ -289,6 +964,7 @@ void PointCloudSensor::setRegistrationParameters(const RegistrationParameters& c
 	mLogger->message(INFO, (boost::format("maximum_iterations:           %1%") % conf.maximum_iterations).str());
 	mLogger->message(INFO, (boost::format("maximum_optimizer_iterations: %1%") % conf.maximum_optimizer_iterations).str());
 	mLogger->message(INFO, (boost::format("point_cloud_density:          %1%") % conf.point_cloud_density).str());
+	mLogger->message(INFO, (boost::format("approximate_downsampling:     %1%") % conf.approximate_downsampling).str());
 	mLogger->message(INFO, (boost::format("rotation_epsilon:             %1%") % conf.rotation_epsilon).str());
 	mLogger->message(INFO, (boost::format("transformation_epsilon:       %1%") % conf.transformation_epsilon).str());
 }
@@ -34,11 +34,18 @@
 
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/registration/registration.h>
+
+#include <deque>
+#include <list>
+#include <mutex>
 
 namespace slam3d
 {
 	typedef pcl::PointXYZ PointType;
 	typedef pcl::PointCloud<PointType> PointCloud;
+	typedef std::shared_ptr< pcl::Registration<PointType, PointType> > RegistrationPtr;
 	
 	/**
 	 * @class PointCloudMeasurement
@@ -47,7 +54,7 @@ namespace slam3d
 	class PointCloudMeasurement : public Measurement
 	{
 	public:
-		typedef boost::shared_ptr<PointCloudMeasurement> Ptr;
+		typedef std::shared_ptr<PointCloudMeasurement> Ptr;
 	
 	public:
 		/**
@@ -72,12 +79,94 @@ namespace slam3d
 		
 		/**
 		 * @brief Gets the point cloud contained within this measurement.
+		 * @details If the payload has been released by an attached
+		 * MeasurementStorage, it is restored before it is returned.
 		 * @return Constant shared pointer to the point cloud
 		 */
-		const PointCloud::Ptr getPointCloud() const {return mPointCloud;}
-		
+		const PointCloud::Ptr getPointCloud() const
+		{
+			// Hold the payload mutex across fetch and read, so the
+			// storage cannot evict the cloud in between.
+			std::lock_guard<std::mutex> guard(mPayloadMutex);
+			fetchPayload();
+			return mPointCloud;
+		}
+
+		/**
+		 * @brief Gets the cloud downsampled with the given voxel size.
+		 * @details Each level is computed once and retained with the
+		 * measurement, so repeated registrations at the same density do
+		 * not re-run the voxel filter on the full-resolution cloud.
+		 * A density of 0 returns the full-resolution cloud.
+		 * @param density leaf size of the voxel filter
+		 */
+		const PointCloud::Ptr getPointCloud(double density) const
+		{
+			if(density <= 0)
+				return getPointCloud();
+
+			std::lock_guard<std::mutex> guard(mLevelMutex);
+			std::map<double, PointCloud::Ptr>::const_iterator it = mLevels.find(density);
+			if(it != mLevels.end())
+				return it->second;
+
+			std::lock_guard<std::mutex> payload_guard(mPayloadMutex);
+			fetchPayload();
+			PointCloud::Ptr level(new PointCloud);
+			if(mPointCloud->size() > 0)
+			{
+				pcl::VoxelGrid<PointType> grid;
+				grid.setLeafSize(density, density, density);
+				grid.setInputCloud(mPointCloud);
+				grid.filter(*level);
+			}
+			mLevels[density] = level;
+			return level;
+		}
+
+		/**
+		 * @brief Gets the cloud downsampled with the approximate voxel filter.
+		 * @details Like getPointCloud(double), but runs the hash-based
+		 * filter of PointCloudSensor::downsampleApprox(). Its levels are
+		 * retained separately from the exact ones, so map export never
+		 * receives approximate cells.
+		 * @param density leaf size of the voxel filter
+		 */
+		const PointCloud::Ptr getApproximatePointCloud(double density) const;
+
+		virtual void serialize(std::ostream& out) const
+		{
+			std::lock_guard<std::mutex> guard(mPayloadMutex);
+			fetchPayload();
+			uint64_t points = mPointCloud->size();
+			out.write(reinterpret_cast<const char*>(&points), sizeof(points));
+			out.write(reinterpret_cast<const char*>(mPointCloud->points.data()), points * sizeof(PointType));
+		}
+
+		virtual void deserialize(std::istream& in)
+		{
+			uint64_t points = 0;
+			in.read(reinterpret_cast<char*>(&points), sizeof(points));
+			PointCloud::Ptr cloud(new PointCloud);
+			cloud->resize(points);
+			in.read(reinterpret_cast<char*>(cloud->points.data()), points * sizeof(PointType));
+			cloud->header.stamp = (mStamp.tv_sec * 1000000l) + mStamp.tv_usec;
+			mPointCloud = cloud;
+		}
+
+		virtual bool isPayloadResident() const { return mPointCloud.get() != NULL; }
+
+		virtual void releasePayload() { mPointCloud.reset(); }
+
 	protected:
 		PointCloud::Ptr mPointCloud;
+
+		// Downsampled versions of the cloud, computed on first use.
+		// They are kept when the payload is released, as they are small
+		// compared to the full-resolution cloud.
+		mutable std::map<double, PointCloud::Ptr> mLevels;
+		mutable std::map<double, PointCloud::Ptr> mApproxLevels;
+		mutable std::mutex mLevelMutex;
 	};
 
 	/**
@@ -106,7 +195,29 @@ namespace slam3d
 		 * @throw BadMeasurementType
 		 */		
 		Measurement::Ptr createCombinedMeasurement(const VertexObjectList& vertices, Transform pose) const;
-		
+
+		/**
+		 * @brief Build a local map patch starting from the given source vertex.
+		 * @details If the rolling patch is enabled and the source is the last
+		 * added vertex, the maintained cloud of the active region is used
+		 * instead of rebuilding the patch from the graph.
+		 * @param source
+		 */
+		Measurement::Ptr buildPatch(IdType source);
+
+		/**
+		 * @brief Enable or disable the rolling patch of the active region.
+		 * @details When enabled, the accumulated cloud around the newest
+		 * vertex is maintained incrementally: each accepted scan is added
+		 * once and the oldest scans are evicted when they leave the patch
+		 * building range. This skips the graph search and the patch solver
+		 * on the sequential-matching path. The patch does not benefit from
+		 * local optimization, so it should only be used when the patch
+		 * solver is disabled anyway.
+		 * @param enable
+		 */
+		void setRollingPatch(bool enable);
+
 		/**
 		 * @brief Create an ICP constraint between two point clouds.
 		 * @param source
@@ -119,6 +230,19 @@ namespace slam3d
 		                                         const Transform& odometry,
 		                                         bool loop);
 		
+		/**
+		 * @brief Configure the motion gate applied before registration.
+		 * @details The gate quantizes the last and the new scan into an
+		 * octree with the given resolution and compares their occupied
+		 * voxels. Only when the fraction of points falling into voxels
+		 * that were empty in the last scan reaches the given threshold,
+		 * the scan is passed on to the full registration. A resolution
+		 * of 0 disables the gate.
+		 * @param resolution voxel size used for the comparison
+		 * @param threshold fraction of novel points required [0..1]
+		 */
+		void setMotionGate(double resolution, double threshold);
+
 		/**
 		 * @brief Sets parameters for the internal pointcloud registration.
 		 * The standard set is always used to calculate the final transformation.
@@ -128,6 +252,50 @@ namespace slam3d
 		 */
 		void setRegistrationParameters(const RegistrationParameters& param, bool coarse);
 		
+		/**
+		 * @brief Configure a multi-resolution registration cascade.
+		 * @details The levels are applied in the given order (typically
+		 * with decreasing point_cloud_density and correspondence
+		 * distance), each seeded with the result of the previous one.
+		 * When a level changes the estimate by less than the given exit
+		 * thresholds, the remaining levels are skipped: easy sequential
+		 * matches terminate at the cheap level, while hard loop closures
+		 * are walked down the whole cascade instead of burning the fine
+		 * level's iteration budget on a bad initial guess. When set, the
+		 * cascade replaces the fixed coarse/fine pair in
+		 * createConstraint(); an empty list restores it. Exit thresholds
+		 * of 0 always run all levels.
+		 * @param levels ordered registration parameters, coarse to fine
+		 * @param exit_translation translation change below which to stop
+		 * @param exit_rotation rotation change below which to stop
+		 */
+		void setRegistrationCascade(const std::vector<RegistrationParameters>& levels,
+		                            double exit_translation = 0,
+		                            double exit_rotation = 0);
+
+		/**
+		 * @brief Set the density levels precomputed for each new scan.
+		 * @details The levels of an accepted scan are generated once when
+		 * its vertex is created, instead of on first use inside align().
+		 * This moves the voxel filtering of the registration densities
+		 * (and of the map resolution, if listed) off the matching hot
+		 * path. Levels not listed here are still computed lazily.
+		 * @param densities leaf sizes to precompute
+		 */
+		void setDownsamplingLevels(const std::vector<double>& densities);
+
+		/**
+		 * @brief Set the size of the registration-structure cache.
+		 * @details Registration rebuilds the indexed cloud's kd-tree (and
+		 * NDT's voxel grid) on every call. The cache keeps the structures
+		 * of recently used measurements, keyed by their unique id and the
+		 * density they were built with, so the sequential path and retried
+		 * loop closures skip the index construction. The given size bounds
+		 * the number of retained entries; 0 disables the cache.
+		 * @param size maximum number of cached registration structures
+		 */
+		void setRegistrationCache(unsigned size);
+
 		/**
 		 * @brief Set density of points in accumulated map cloud.
 		 * @param r
@@ -148,7 +316,19 @@ namespace slam3d
 		 * @param resolution 
 		 */
 		PointCloud::Ptr downsample(PointCloud::ConstPtr source, double resolution) const;
-		
+
+		/**
+		 * @brief Reduces the size of the source cloud with an approximate voxel filter.
+		 * @details Single pass over the cloud into an open-addressing voxel
+		 * hash that keeps a running mean per cell, instead of the sorting
+		 * done by pcl::VoxelGrid. Cell averages can differ marginally from
+		 * the exact filter, which is fine as registration input; use
+		 * downsample() where exact centroids matter, e.g. for map export.
+		 * @param source
+		 * @param resolution
+		 */
+		PointCloud::Ptr downsampleApprox(PointCloud::ConstPtr source, double resolution) const;
+
 		/**
 		 * @brief Transform source cloud by given transformation.
 		 * @param source
@@ -170,16 +350,40 @@ namespace slam3d
 		 * @details The individual point clouds are transformed by their current pose in the graph,
 		 * no additional alignement or optimization is performed during this.
 		 * @param vertices
+		 * @param density accumulate this downsampling level instead of the full clouds
 		 * @return accumulated pointcloud
 		 * @throw BadMeasurementType
 		 */
-		PointCloud::Ptr getAccumulatedCloud(const VertexObjectList& vertices) const;
+		PointCloud::Ptr getAccumulatedCloud(const VertexObjectList& vertices, double density = 0) const;
 		
 		/**
 		 * @brief Build an accumulated point cloud map from given vertices.
 		 * @param vertices
 		 */
 		PointCloud::Ptr buildMap(const VertexObjectList& vertices) const;
+
+		/**
+		 * @brief Build the map in spatial chunks and emit each one as it
+		 * is finished.
+		 * @details Alternative to buildMap() for large maps: the scans
+		 * are sorted into cubic chunks during accumulation, then outlier
+		 * removal and voxel filtering run per chunk on parallel workers.
+		 * Finished chunks are passed to the callback immediately, so a
+		 * consumer can start writing or publishing the map before the
+		 * last chunk is processed, and no intermediate full-map cloud is
+		 * ever materialized. Points within the outlier radius of a chunk
+		 * border are duplicated into the neighbor's halo, so the filter
+		 * sees the same neighborhoods as a full-map pass. The callback
+		 * is invoked from the workers, but never concurrently.
+		 * @param vertices
+		 * @param callback receives each finished chunk
+		 * @param chunk_size edge length of the cubic chunks
+		 * @param threads number of workers, 0 uses all hardware threads
+		 */
+		void buildMapChunked(const VertexObjectList& vertices,
+		                     std::function<void(PointCloud::Ptr)> callback,
+		                     double chunk_size,
+		                     unsigned threads = 0) const;
 		
 		/**
 		 * @brief Fill ground plane around center.
@@ -193,22 +397,92 @@ namespace slam3d
 		void fillGroundPlane(PointCloud::Ptr cloud, ScalarType radius);
 	
 	protected:
+		/**
+		 * @brief Estimate scan overlap to decide whether the robot moved.
+		 * @param source
+		 * @param target
+		 */
+		bool detectMotion(const Measurement::Ptr& source, const Measurement::Ptr& target);
+
+		/**
+		 * @brief Add the newest scan to the rolling patch.
+		 * @param vertex
+		 */
+		void onVertexAdded(IdType vertex);
+
+		/**
+		 * @brief Re-transform all rolling patch segments with current poses.
+		 * @details Called when an optimization has moved the poses since the
+		 * segments were added. The caller must hold mRollingMutex.
+		 */
+		void refreshRollingPatch();
+
 		Transform align(PointCloudMeasurement::Ptr source, PointCloudMeasurement::Ptr target,
+		                const Transform& guess, const RegistrationParameters& config,
+		                unsigned threads = 0);
+
+		Transform doICP(RegistrationPtr registration, PointCloud::Ptr target,
 		                const Transform& guess, const RegistrationParameters& config);
 
-		Transform doICP(PointCloud::Ptr source, PointCloud::Ptr target,
+		Transform doNDT(RegistrationPtr registration, PointCloud::Ptr target,
 		                const Transform& guess, const RegistrationParameters& config);
 
-		Transform doNDT(PointCloud::Ptr source, PointCloud::Ptr target,
+		Transform doGPU(RegistrationPtr registration, PointCloud::Ptr target,
 		                const Transform& guess, const RegistrationParameters& config);
 
+		/**
+		 * @brief Return checked-out registration structures to the cache.
+		 * @param uuid unique id of the indexed measurement
+		 * @param algorithm the effectively used algorithm
+		 * @param config parameters the structures were built with
+		 * @param filtered the indexed cloud
+		 * @param registration
+		 */
+		void storeRegistration(const boost::uuids::uuid& uuid,
+		                       RegistrationAlgorithm algorithm,
+		                       const RegistrationParameters& config,
+		                       PointCloud::Ptr filtered,
+		                       RegistrationPtr registration);
+
 	protected:
 		RegistrationParameters mFineConfiguration;
 		RegistrationParameters mCoarseConfiguration;
-		
+
+		std::vector<RegistrationParameters> mRegistrationCascade;
+		double mCascadeExitTranslation;
+		double mCascadeExitRotation;
+
 		double   mMapResolution;
 		double   mMapOutlierRadius;
 		unsigned mMapOutlierNeighbors;
+
+		double mMotionGateResolution;
+		double mMotionGateThreshold;
+
+		std::vector<double> mDownsamplingLevels;
+
+		// Registration structures of recently used measurements in LRU
+		// order. The indexed cloud is kept alongside, as the registration
+		// only references it.
+		struct RegistrationCacheEntry
+		{
+			boost::uuids::uuid uuid;
+			RegistrationAlgorithm algorithm;
+			double density;
+			double resolution;
+			PointCloud::Ptr filtered;
+			RegistrationPtr registration;
+		};
+		std::list<RegistrationCacheEntry> mRegistrationCache;
+		unsigned mRegistrationCacheSize;
+		std::mutex mRegistrationCacheMutex;
+
+		// Clouds of the newest vertices, each transformed into the map
+		// frame once when its scan was accepted
+		bool mUseRollingPatch;
+		std::deque< std::pair<IdType, PointCloud::Ptr> > mRollingSegments;
+		unsigned long mRollingPoseRevision;
+		std::mutex mRollingMutex;
 	};
 }
 
@@ -0,0 +1,217 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Benchmark of the point cloud registration path over the clouds shipped
+// in test/. Each phase is timed at several density settings and reported
+// as CSV on stdout, so runs can be stored and compared:
+//
+//   registration_benchmark [data-dir] [repeats]      > baseline.csv
+//   registration_benchmark --compare baseline.csv current.csv
+
+#include "PointCloudSensor.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+using namespace slam3d;
+
+namespace
+{
+	// Each record in the cloud files is x, y, z and one padding float
+	PointCloud::Ptr loadCloud(const std::string& filename)
+	{
+		std::ifstream file(filename.c_str(), std::ios::binary);
+		if(!file.is_open())
+		{
+			throw std::runtime_error("Could not open " + filename);
+		}
+		PointCloud::Ptr cloud(new PointCloud);
+		float record[4];
+		while(file.read(reinterpret_cast<char*>(record), sizeof(record)))
+		{
+			cloud->push_back(PointType(record[0], record[1], record[2]));
+		}
+		return cloud;
+	}
+
+	// Run the workload the given number of times and report the best run,
+	// so scheduling noise does not end up in the stored numbers.
+	double timeBest(unsigned repeats, const std::function<void()>& workload)
+	{
+		double best = -1;
+		for(unsigned i = 0; i < repeats; i++)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			workload();
+			double seconds = std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - start).count();
+			if(best < 0 || seconds < best)
+				best = seconds;
+		}
+		return best;
+	}
+
+	void report(const std::string& phase, double density, double seconds, std::size_t points)
+	{
+		std::cout << phase << "," << density << "," << seconds << ","
+		          << points << "," << (std::size_t)(points / seconds) << "\n";
+	}
+
+	// Read a result file back into (phase,density) -> (seconds, points/sec)
+	std::map<std::string, std::pair<double, double> > loadResults(const std::string& filename)
+	{
+		std::ifstream file(filename.c_str());
+		if(!file.is_open())
+		{
+			throw std::runtime_error("Could not open " + filename);
+		}
+		std::map<std::string, std::pair<double, double> > results;
+		std::string line;
+		std::getline(file, line); // header
+		while(std::getline(file, line))
+		{
+			std::istringstream row(line);
+			std::string phase, density, seconds, points, rate;
+			std::getline(row, phase, ',');
+			std::getline(row, density, ',');
+			std::getline(row, seconds, ',');
+			std::getline(row, points, ',');
+			std::getline(row, rate, ',');
+			results[phase + "@" + density] =
+				std::make_pair(atof(seconds.c_str()), atof(rate.c_str()));
+		}
+		return results;
+	}
+
+	int compare(const std::string& before, const std::string& after)
+	{
+		std::map<std::string, std::pair<double, double> > a = loadResults(before);
+		std::map<std::string, std::pair<double, double> > b = loadResults(after);
+		std::cout << "benchmark,before_seconds,after_seconds,speedup\n";
+		for(std::map<std::string, std::pair<double, double> >::iterator it = a.begin(); it != a.end(); ++it)
+		{
+			std::map<std::string, std::pair<double, double> >::iterator match = b.find(it->first);
+			if(match == b.end())
+				continue;
+			std::cout << it->first << "," << it->second.first << ","
+			          << match->second.first << ","
+			          << (it->second.first / match->second.first) << "\n";
+		}
+		return 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if(argc == 4 && std::string(argv[1]) == "--compare")
+	{
+		return compare(argv[2], argv[3]);
+	}
+
+	std::string dir = (argc > 1) ? argv[1] : "test";
+	unsigned repeats = (argc > 2) ? atoi(argv[2]) : 3;
+	double densities[] = {0.1, 0.2, 0.4};
+
+	Clock clock;
+	Logger logger(clock);
+	logger.setLogLevel(ERROR);
+	PointCloudSensor sensor("Benchmark", &logger);
+
+	// Load the shipped clouds and wrap them like the mapper would
+	std::vector<PointCloudMeasurement::Ptr> measurements;
+	VertexObjectList vertices;
+	std::size_t total_points = 0;
+	for(int i = 1; i <= 4; i++)
+	{
+		std::ostringstream filename;
+		filename << dir << "/cloud" << i << ".bin";
+		PointCloud::Ptr cloud = loadCloud(filename.str());
+		total_points += cloud->size();
+		PointCloudMeasurement::Ptr m(new PointCloudMeasurement(
+			cloud, "Benchmark", "Benchmark", Transform::Identity()));
+		measurements.push_back(m);
+
+		VertexObject vo;
+		vo.index = i;
+		vo.corrected_pose = Transform::Identity();
+		vo.measurement = m;
+		vertices.push_back(vo);
+	}
+
+	std::cout << "phase,density,seconds,points,points_per_second\n";
+	for(double density : densities)
+	{
+		std::size_t points = measurements[0]->getPointCloud()->size();
+		report("downsample", density, timeBest(repeats, [&]
+		{
+			sensor.downsample(measurements[0]->getPointCloud(), density);
+		}), points);
+
+		report("downsample_approx", density, timeBest(repeats, [&]
+		{
+			sensor.downsampleApprox(measurements[0]->getPointCloud(), density);
+		}), points);
+
+		// Use fresh measurements per run, so memoized density levels and
+		// the registration cache do not hide the filtering cost.
+		RegistrationParameters config;
+		config.point_cloud_density = density;
+		sensor.setRegistrationParameters(config, false);
+		report("align", density, timeBest(repeats, [&]
+		{
+			for(std::size_t i = 0; i + 1 < measurements.size(); i++)
+			{
+				PointCloudMeasurement::Ptr source(new PointCloudMeasurement(
+					measurements[i]->getPointCloud(), "Benchmark", "Benchmark", Transform::Identity()));
+				PointCloudMeasurement::Ptr target(new PointCloudMeasurement(
+					measurements[i + 1]->getPointCloud(), "Benchmark", "Benchmark", Transform::Identity()));
+				try
+				{
+					sensor.createConstraint(source, target, Transform::Identity(), false);
+				}catch(NoMatch &e)
+				{
+					// A failed match is still a valid timing sample
+				}
+			}
+		}), total_points);
+
+		report("accumulate", density, timeBest(repeats, [&]
+		{
+			sensor.getAccumulatedCloud(vertices, density);
+		}), total_points);
+
+		sensor.setMapResolution(density);
+		report("build_map", density, timeBest(repeats, [&]
+		{
+			sensor.buildMap(vertices);
+		}), total_points);
+	}
+	return 0;
+}
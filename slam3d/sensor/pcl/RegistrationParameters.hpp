@@ -28,7 +28,10 @@
 
 namespace slam3d
 {
-	enum RegistrationAlgorithm {ICP, GICP, NDT};
+	// The GPU variants run on the device with resident clouds and require
+	// a build with SLAM3D_GPU_REGISTRATION; without it they fall back to
+	// their CPU counterpart.
+	enum RegistrationAlgorithm {ICP, GICP, NDT, GICP_GPU, NDT_GPU};
 
 	/**
 	 * @class GICPConfiguration
@@ -45,6 +48,10 @@ namespace slam3d
 		// pointclouds will be downsampled to this density before the alignement
 		double point_cloud_density;
 
+		// use the fast approximate voxel filter instead of pcl::VoxelGrid
+		// when downsampling for the alignement
+		bool approximate_downsampling;
+
 		// maximum fitness score (e.g., sum of squared distances from the source to the target)
 		// to accept the registration result
 		double max_fitness_score;
@@ -92,6 +99,7 @@ namespace slam3d
 
 		RegistrationParameters() : registration_algorithm(GICP),
 		                           point_cloud_density(0.2),
+		                           approximate_downsampling(false),
 		                           max_fitness_score(2.0),
 		                           euclidean_fitness_epsilon(1.0),
 		                           transformation_epsilon(1e-5),
@@ -2,6 +2,7 @@
 
 #include <math.h>
 #include <fstream>
+#include <sstream>
 
 using namespace slam3d;
 
@@ -11,7 +12,6 @@ Scan2DSensor::Scan2DSensor(const std::string& n, Logger* l, const std::string& c
 	if (configFile.empty())
 	{
 		mLogger->message(INFO, "No ICP configuration specified, using default.");
-		mICP.setDefault();
 	}else
 	{
 		// load YAML config
@@ -19,17 +19,134 @@ Scan2DSensor::Scan2DSensor(const std::string& n, Logger* l, const std::string& c
 		if (!ifs.good())
 		{
 			mLogger->message(WARNING, (boost::format("Could not load ICP configuration from: %1%") % configFile).str());
-			mICP.setDefault();
+		}else
+		{
+			// Keep the text, so the per-thread ICP objects can be
+			// configured without touching the file again
+			std::stringstream buffer;
+			buffer << ifs.rdbuf();
+			mConfigYaml = buffer.str();
+			mLogger->message(INFO, (boost::format("Successfully loaded ICP configuration from: %1%") % configFile).str());
 		}
-		mICP.loadFromYaml(ifs);
-		mLogger->message(INFO, (boost::format("Successfully loaded ICP configuration from: %1%") % configFile).str());
 	}
+
+	// Take the filter chains out of the configuration; scans are filtered
+	// once by the sensor and cached, not inside every ICP call
+	PM::ICP icp;
+	configureICP(icp);
+	mReadingFilters = icp.readingDataPointsFilters;
+	mReferenceFilters = icp.referenceDataPointsFilters;
+
+	mTransformation = PM::get().REG(Transformation).create("RigidTransformation");
+	mFilterCacheSize = 100;
 	mWriteDebugData = false;
+	mDebugShutdown = false;
+	mDebugCounter = 0;
 }
 
 Scan2DSensor::~Scan2DSensor()
 {
-	
+	if(mDebugWriter.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> guard(mDebugMutex);
+			mDebugShutdown = true;
+		}
+		mDebugCondition.notify_all();
+		mDebugWriter.join();
+	}
+
+	for(std::deque<PM::ICP*>::iterator it = mICPPool.begin(); it != mICPPool.end(); ++it)
+	{
+		delete *it;
+	}
+}
+
+void Scan2DSensor::configureICP(PM::ICP& icp)
+{
+	if(mConfigYaml.empty())
+	{
+		icp.setDefault();
+	}else
+	{
+		std::istringstream iss(mConfigYaml);
+		icp.loadFromYaml(iss);
+	}
+}
+
+PM::ICP* Scan2DSensor::acquireICP()
+{
+	{
+		std::lock_guard<std::mutex> guard(mICPPoolMutex);
+		if(!mICPPool.empty())
+		{
+			PM::ICP* icp = mICPPool.back();
+			mICPPool.pop_back();
+			return icp;
+		}
+	}
+	PM::ICP* icp = new PM::ICP;
+	configureICP(*icp);
+
+	// The inputs arrive pre-filtered from the cache
+	icp->readingDataPointsFilters.clear();
+	icp->referenceDataPointsFilters.clear();
+	mLogger->message(DEBUG, "Created an additional ICP chain for parallel matching.");
+	return icp;
+}
+
+void Scan2DSensor::releaseICP(PM::ICP* icp)
+{
+	std::lock_guard<std::mutex> guard(mICPPoolMutex);
+	mICPPool.push_back(icp);
+}
+
+void Scan2DSensor::setFilterCache(unsigned size)
+{
+	mLogger->message(INFO, (boost::format("filter_cache:           %1%") % size).str());
+	std::lock_guard<std::mutex> guard(mFilterCacheMutex);
+	mFilterCacheSize = size;
+	while(mFilterCache.size() > mFilterCacheSize)
+	{
+		mFilterCache.pop_back();
+	}
+}
+
+std::shared_ptr<PM::DataPoints> Scan2DSensor::getFilteredDataPoints(const Scan2DMeasurement::Ptr& scan, bool reading)
+{
+	std::lock_guard<std::mutex> guard(mFilterCacheMutex);
+	boost::uuids::uuid uuid = scan->getUniqueId();
+	std::list<FilteredScan>::iterator it = mFilterCache.begin();
+	while(it != mFilterCache.end() && it->uuid != uuid)
+	{
+		++it;
+	}
+	if(it == mFilterCache.end())
+	{
+		FilteredScan entry;
+		entry.uuid = uuid;
+		mFilterCache.push_front(entry);
+		it = mFilterCache.begin();
+		while(mFilterCache.size() > mFilterCacheSize && mFilterCache.size() > 1)
+		{
+			mFilterCache.pop_back();
+		}
+	}else if(it != mFilterCache.begin())
+	{
+		// Move it to the front of the LRU list
+		mFilterCache.splice(mFilterCache.begin(), mFilterCache, it);
+	}
+
+	std::shared_ptr<PM::DataPoints>& slot = reading ? it->reading : it->reference;
+	if(!slot)
+	{
+		slot.reset(new PM::DataPoints(scan->getDataPoints()));
+		if(reading)
+			mReadingFilters.apply(*slot);
+		else
+			mReferenceFilters.apply(*slot);
+	}
+	return slot;
 }
 
 Transform Scan2DSensor::convert2Dto3D(const PM::TransformationParameters& in) const
@@ -65,43 +182,95 @@ Constraint::Ptr Scan2DSensor::createConstraint(const Measurement::Ptr& source,
 	Transform guess = source->getInverseSensorPose() * odometry * target->getSensorPose();
 
 	// Cast to this sensors measurement type
-	Scan2DMeasurement::Ptr sourceScan = boost::dynamic_pointer_cast<Scan2DMeasurement>(source);
-	Scan2DMeasurement::Ptr targetScan = boost::dynamic_pointer_cast<Scan2DMeasurement>(target);
+	Scan2DMeasurement::Ptr sourceScan = std::dynamic_pointer_cast<Scan2DMeasurement>(source);
+	Scan2DMeasurement::Ptr targetScan = std::dynamic_pointer_cast<Scan2DMeasurement>(target);
 	if(!sourceScan || !targetScan)
 	{
 		mLogger->message(ERROR, "Measurement given to calculateTransform() is not a Scan!");
 		throw BadMeasurementType();
 	}
-	
+
+	// Filtered scans come from the cache, so a scan is not re-filtered
+	// when it takes part in another match
+	std::shared_ptr<PM::DataPoints> reference = getFilteredDataPoints(sourceScan, false);
+	std::shared_ptr<PM::DataPoints> reading = getFilteredDataPoints(targetScan, true);
+
 	// Transform target by odometry transform
-	std::shared_ptr<PM::Transformation> rigidTrans;
-	rigidTrans = PM::get().REG(Transformation).create("RigidTransformation");
-	const PM::DataPoints initializedTarget = rigidTrans->compute(targetScan->getDataPoints(), convert3Dto2D(guess));
-
-//	if(debug)
-//	{
-//		sourceScan->getDataPoints().save("source.vtk");
-//		initializedTarget.save("target.vtk");
-//	}
-	
-	// Perform ICP
-	PM::TransformationParameters tp = mICP(initializedTarget, sourceScan->getDataPoints());
+	const PM::DataPoints initializedTarget = mTransformation->compute(*reading, convert3Dto2D(guess));
+
+	if(mWriteDebugData && loop)
+	{
+		std::lock_guard<std::mutex> guard(mDebugMutex);
+		DebugDump dump;
+		dump.reading = initializedTarget;
+		dump.reference = *reference;
+		dump.name = (boost::format("icp_%1%") % mDebugCounter++).str();
+		mDebugQueue.push_back(dump);
+		mDebugCondition.notify_one();
+	}
+
+	// Perform ICP with an object checked out of the pool; it belongs to
+	// this match exclusively until it is released.
+	PM::ICP* icp = acquireICP();
+
+	// Returns the ICP object to the pool on every exit path
+	struct PoolGuard
+	{
+		Scan2DSensor* sensor;
+		PM::ICP* icp;
+		~PoolGuard() { sensor->releaseICP(icp); }
+	} pool_guard{this, icp};
+
+	PM::TransformationParameters tp = (*icp)(initializedTarget, *reference);
 	Transform icp_result = guess * convert2Dto3D(tp);
 
 	// Transform back to robot frame
 	Transform transform = source->getSensorPose() * icp_result * target->getInverseSensorPose();
 	Covariance<6> covariance = Covariance<6>::Identity() * mCovarianceScale;
-	
+
 	return Constraint::Ptr(new SE3Constraint(mName, transform, covariance.inverse()));
 }
 
+void Scan2DSensor::writeDebugData(bool debug)
+{
+	mWriteDebugData = debug;
+	if(debug && !mDebugWriter.joinable())
+	{
+		mDebugWriter = std::thread(&Scan2DSensor::runDebugWriter, this);
+	}
+}
+
+void Scan2DSensor::runDebugWriter()
+{
+	std::unique_lock<std::mutex> lock(mDebugMutex);
+	while(true)
+	{
+		while(mDebugQueue.empty() && !mDebugShutdown)
+		{
+			mDebugCondition.wait(lock);
+		}
+		if(mDebugQueue.empty())
+			return;
+
+		DebugDump dump = std::move(mDebugQueue.front());
+		mDebugQueue.pop_front();
+
+		// Write without holding the lock, so matching threads can keep
+		// queueing dumps while the disk is busy
+		lock.unlock();
+		dump.reading.save(dump.name + "_reading.vtk");
+		dump.reference.save(dump.name + "_reference.vtk");
+		lock.lock();
+	}
+}
+
 Measurement::Ptr Scan2DSensor::createCombinedMeasurement(const VertexObjectList& vertices, Transform pose) const
 {
 	// Concatenate all scans into one
 	PM::DataPoints accu = createDataPoints();
 	for(VertexObjectList::const_iterator it = vertices.begin(); it != vertices.end(); it++)
 	{
-		Scan2DMeasurement::Ptr scan = boost::dynamic_pointer_cast<Scan2DMeasurement>(it->measurement);
+		Scan2DMeasurement::Ptr scan = std::dynamic_pointer_cast<Scan2DMeasurement>(it->measurement);
 		if(!scan)
 		{
 			mLogger->message(WARNING, "Measurement is not a Scan2D!");
@@ -111,9 +280,9 @@ Measurement::Ptr Scan2DSensor::createCombinedMeasurement(const VertexObjectList&
 	}
 
 	// Transform to target frame
-	PM::DataPoints accu_tf = transformDataPoints(accu, pose.inverse());	
+	PM::DataPoints accu_tf = transformDataPoints(accu, pose.inverse());
 	timeval t;
-	return Scan2DMeasurement::Ptr(new Scan2DMeasurement(accu_tf, t, "AccumulatedScan", mName, Transform::Identity()));
+	return std::make_shared<Scan2DMeasurement>(accu_tf, t, "AccumulatedScan", mName, Transform::Identity());
 }
 
 PM::DataPoints Scan2DSensor::createDataPoints() const
@@ -122,18 +291,17 @@ PM::DataPoints Scan2DSensor::createDataPoints() const
 	feat_labels.push_back(PM::DataPoints::Label("x", 1));
 	feat_labels.push_back(PM::DataPoints::Label("y", 1));
 	feat_labels.push_back(PM::DataPoints::Label("w", 1));
-	
-	PM::Matrix feat_points(3, 0);	
+
+	PM::Matrix feat_points(3, 0);
 	return PM::DataPoints(feat_points, feat_labels);
 }
 
 PM::DataPoints Scan2DSensor::transformDataPoints(const PM::DataPoints& source, const Transform tf) const
 {
-	std::shared_ptr<PM::Transformation> rigidTrans = PM::get().REG(Transformation).create("RigidTransformation");
 	PM::TransformationParameters tp = convert3Dto2D(tf);
-	if (!rigidTrans->checkParameters(tp))
+	if (!mTransformation->checkParameters(tp))
 	{
-		tp = rigidTrans->correctParameters(tp);
+		tp = mTransformation->correctParameters(tp);
 	}
-	return rigidTrans->compute(source,tp);
+	return mTransformation->compute(source, tp);
 }
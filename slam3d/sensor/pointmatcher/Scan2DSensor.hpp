@@ -31,6 +31,13 @@
 
 #include <pointmatcher/PointMatcher.h>
 
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 namespace slam3d
 {
 	typedef PointMatcher<ScalarType> PM;
@@ -42,7 +49,7 @@ namespace slam3d
 	class Scan2DMeasurement : public Measurement
 	{
 	public:
-		typedef boost::shared_ptr<Scan2DMeasurement> Ptr;
+		typedef std::shared_ptr<Scan2DMeasurement> Ptr;
 
 		Scan2DMeasurement(const PM::DataPoints& points, timeval t,
 	                    const std::string& r, const std::string& s,
@@ -120,14 +127,94 @@ namespace slam3d
 
 		/**
 		 * @brief Activate writing of source and target pointclouds when perfomring loop closures.
+		 * @details The scans are written by a background thread, so the
+		 * matching itself is not slowed down by disk access.
 		 * @param debug
 		 */
-		void writeDebugData(bool debug = true) { mWriteDebugData = debug; }
+		void writeDebugData(bool debug = true);
+
+		/**
+		 * @brief Set the number of filtered scans kept in the cache.
+		 * @details Recently matched scans are kept in LRU order, so a scan
+		 * is not re-filtered when it takes part in another match. The
+		 * limit bounds the memory held by the cache on long missions.
+		 * @param size
+		 */
+		void setFilterCache(unsigned size);
 
 	protected:
-		PM::ICP mICP;
+		/**
+		 * @brief Check an ICP object out of the pool.
+		 * @details Created and configured on first use and returned via
+		 * releaseICP() after the match, so parallel loop closure
+		 * evaluations neither share one ICP object nor re-parse the
+		 * configuration per match, and the short-lived threads of batch
+		 * linking do not grow a per-thread map without bound.
+		 * Its data points filters are cleared, because createConstraint()
+		 * hands it pre-filtered scans from the cache.
+		 */
+		PM::ICP* acquireICP();
 
-		bool mWriteDebugData; 
+		/**
+		 * @brief Return an ICP object to the pool.
+		 * @param icp
+		 */
+		void releaseICP(PM::ICP* icp);
+
+		/**
+		 * @brief Get a scan with the configured filter chain applied.
+		 * @details The result is cached with the measurement's unique id
+		 * and returned as a shared pointer, so it stays valid even when
+		 * the cache evicts the entry during a concurrent match.
+		 * @param scan
+		 * @param reading whether to apply the reading or the reference chain
+		 */
+		std::shared_ptr<PM::DataPoints> getFilteredDataPoints(const Scan2DMeasurement::Ptr& scan, bool reading);
+
+		void configureICP(PM::ICP& icp);
+		void runDebugWriter();
+
+		// Configuration kept as text, so per-thread ICP objects can be
+		// created long after construction
+		std::string mConfigYaml;
+
+		// Created once; compute() is safe to share between threads
+		std::shared_ptr<PM::Transformation> mTransformation;
+
+		// Filter chains taken from the configuration, applied by the
+		// sensor instead of inside every ICP call
+		PM::DataPointsFilters mReadingFilters;
+		PM::DataPointsFilters mReferenceFilters;
+
+		// Filtered scans of recently matched measurements in LRU order
+		struct FilteredScan
+		{
+			boost::uuids::uuid uuid;
+			std::shared_ptr<PM::DataPoints> reading;
+			std::shared_ptr<PM::DataPoints> reference;
+		};
+		std::list<FilteredScan> mFilterCache;
+		unsigned mFilterCacheSize;
+		std::mutex mFilterCacheMutex;
+
+		// Configured ICP objects not checked out by a match right now
+		std::deque<PM::ICP*> mICPPool;
+		std::mutex mICPPoolMutex;
+
+		bool mWriteDebugData;
+
+		struct DebugDump
+		{
+			PM::DataPoints reading;
+			PM::DataPoints reference;
+			std::string name;
+		};
+		std::deque<DebugDump> mDebugQueue;
+		std::mutex mDebugMutex;
+		std::condition_variable mDebugCondition;
+		std::thread mDebugWriter;
+		bool mDebugShutdown;
+		unsigned mDebugCounter;
 	};
 }
 
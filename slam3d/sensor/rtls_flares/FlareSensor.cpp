@@ -6,6 +6,7 @@ FlareSensor::FlareSensor(Graph* g, Logger* l) : PoseSensor("RTLS-Flares", g, l)
 {
 	mTimestamp.tv_sec = 0;
 	mTimestamp.tv_usec = 0;
+	mAnchorVertex = 0;
 	mHasNewData = false;
 }
 
@@ -55,7 +56,11 @@ void FlareSensor::handleNewVertex(IdType vertex)
 	pos(2) = 0;
 	slam3d::PositionConstraint::Ptr position(new slam3d::PositionConstraint(
 		mName, pos,	slam3d::Covariance<3>::Identity() * mCovarianceScale, mSensorPose));
-	mGraph->addConstraint(vertex, 0, position);
+	// Position constraints are unary priors in the solver; the target only
+	// affects the graph structure. Chaining it through the previously
+	// constrained vertex avoids a star of edges around vertex 0.
+	mGraph->addConstraint(vertex, mAnchorVertex, position);
+	mAnchorVertex = vertex;
 	mHasNewData = false;
 }
 
@@ -23,6 +23,7 @@ namespace slam3d
 		Clock mClock;
 		timeval mTimestamp;
 		Transform mSensorPose;
+		IdType mAnchorVertex;
 		bool mHasNewData;
 	};
 }
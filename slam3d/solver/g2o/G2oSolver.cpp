@@ -33,33 +33,106 @@
 #include <g2o/core/optimization_algorithm_levenberg.h>
 #include <g2o/types/slam3d/types_slam3d.h>
 #include <g2o/solvers/cholmod/linear_solver_cholmod.h>
+#include <g2o/solvers/csparse/linear_solver_csparse.h>
+#include <g2o/solvers/eigen/linear_solver_eigen.h>
+#include <g2o/solvers/pcg/linear_solver_pcg.h>
 #include <g2o/core/sparse_optimizer_terminate_action.h>
 
 #include <boost/format.hpp>
 
+#include <algorithm>
+#include <chrono>
+
 using namespace slam3d;
 
-typedef g2o::LinearSolverCholmod<g2o::BlockSolver_6_3::PoseMatrixType> SlamLinearSolver;
+typedef g2o::BlockSolver_6_3::PoseMatrixType SlamMatrixType;
+
+namespace
+{
+	g2o::OptimizationAlgorithm* createAlgorithm(slam3d::LinearSolverType type, bool blockOrdering)
+	{
+		std::unique_ptr<g2o::BlockSolver_6_3::LinearSolverType> linearSolver;
+		switch(type)
+		{
+		case slam3d::CSPARSE:
+		{
+			std::unique_ptr<g2o::LinearSolverCSparse<SlamMatrixType>> ls(new g2o::LinearSolverCSparse<SlamMatrixType>);
+			ls->setBlockOrdering(blockOrdering);
+			linearSolver = std::move(ls);
+			break;
+		}
+		case slam3d::EIGEN:
+		{
+			std::unique_ptr<g2o::LinearSolverEigen<SlamMatrixType>> ls(new g2o::LinearSolverEigen<SlamMatrixType>);
+			ls->setBlockOrdering(blockOrdering);
+			linearSolver = std::move(ls);
+			break;
+		}
+		case slam3d::PCG:
+		{
+			linearSolver.reset(new g2o::LinearSolverPCG<SlamMatrixType>);
+			break;
+		}
+		default:
+		{
+			std::unique_ptr<g2o::LinearSolverCholmod<SlamMatrixType>> ls(new g2o::LinearSolverCholmod<SlamMatrixType>);
+			ls->setBlockOrdering(blockOrdering);
+			linearSolver = std::move(ls);
+			break;
+		}
+		}
+		std::unique_ptr<g2o::BlockSolver_6_3> blockSolver(new g2o::BlockSolver_6_3(std::move(linearSolver)));
+		return new g2o::OptimizationAlgorithmLevenberg(std::move(blockSolver));
+	}
+
+	const char* solverName(slam3d::LinearSolverType type)
+	{
+		switch(type)
+		{
+		case slam3d::CSPARSE: return "csparse";
+		case slam3d::EIGEN:   return "eigen";
+		case slam3d::PCG:     return "pcg";
+		default:      return "cholmod";
+		}
+	}
+}
 
 struct G2oSolver::Internal
 {
 	g2o::SparseOptimizer optimizer;
 	g2o::HyperGraph::VertexSet newVertices;
 	g2o::HyperGraph::EdgeSet newEdges;
+	g2o::HyperGraph::VertexSet window;
 };
 
 G2oSolver::G2oSolver(Logger* logger) : Solver(logger), mInt(new Internal)
 {
 	// Initialize the SparseOptimizer
-	std::unique_ptr<SlamLinearSolver> linearSolver(new SlamLinearSolver);
-	linearSolver->setBlockOrdering(true);
-	std::unique_ptr<g2o::BlockSolver_6_3> blockSolver(new g2o::BlockSolver_6_3(std::move(linearSolver)));
-	mInt->optimizer.setAlgorithm(new g2o::OptimizationAlgorithmLevenberg(std::move(blockSolver)));
-	
+	mInt->optimizer.setAlgorithm(createAlgorithm(CHOLMOD, true));
+
 	// Set the default terminate action
 	g2o::SparseOptimizerTerminateAction* terminateAction = new g2o::SparseOptimizerTerminateAction;
 	mInt->optimizer.addPostIterationAction(terminateAction);
-	
+
+	mWindowSize = 0;
+	mVerifyEdges = true;
+	mStatistics.initialization_time = 0;
+	mStatistics.optimization_time = 0;
+	mStatistics.iterations = 0;
+	mInitialized = false;
+}
+
+void G2oSolver::setLinearSolver(LinearSolverType type, bool blockOrdering)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	mLogger->message(INFO, (boost::format("linear_solver:          %1%") % solverName(type)).str());
+	mLogger->message(INFO, (boost::format("block_ordering:         %1%") % blockOrdering).str());
+
+	// Replace the algorithm; the optimizer does not own the old one
+	// anymore after this, so it has to be deleted here.
+	const g2o::OptimizationAlgorithm* old = mInt->optimizer.algorithm();
+	mInt->optimizer.setAlgorithm(createAlgorithm(type, blockOrdering));
+	delete old;
 	mInitialized = false;
 }
 
@@ -146,6 +219,33 @@ void G2oSolver::addEdgeOrientation(IdType vertex, OrientationConstraint::Ptr ori
 	mInt->newEdges.insert(prior);
 }
 
+void G2oSolver::removeVertex(IdType id)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+
+	g2o::OptimizableGraph::Vertex* v = mInt->optimizer.vertex(id);
+	if(!v)
+	{
+		throw UnknownVertex(id);
+	}
+
+	// Forget pending incremental updates that refer to this vertex
+	mInt->newVertices.erase(v);
+	for(g2o::HyperGraph::EdgeSet::iterator e = v->edges().begin(); e != v->edges().end(); ++e)
+	{
+		mInt->newEdges.erase(*e);
+	}
+
+	// Removes the vertex together with all of its edges
+	mInt->optimizer.removeVertex(v);
+	mReportedPoses.erase(id);
+	mFrozenVertices.erase(id);
+
+	// The active sub-graph has changed, so the next compute() has to
+	// initialize from scratch instead of an incremental update.
+	mInitialized = false;
+}
+
 void G2oSolver::setFixed(IdType id)
 {
 	boost::unique_lock<boost::mutex> guard(mMutex);
@@ -160,6 +260,59 @@ void G2oSolver::setFixed(IdType id)
 	v->setFixed(true);
 }
 
+void G2oSolver::setWindowSize(unsigned size)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	mLogger->message(INFO, (boost::format("window_size:            %1%") % size).str());
+	if(size == 0 && mWindowSize > 0)
+	{
+		// Re-activate the full history for a final optimization
+		for(std::set<IdType>::iterator it = mFrozenVertices.begin(); it != mFrozenVertices.end(); ++it)
+		{
+			g2o::OptimizableGraph::Vertex* v = mInt->optimizer.vertex(*it);
+			if(v)
+			{
+				v->setFixed(false);
+			}
+		}
+		mFrozenVertices.clear();
+		mInitialized = false;
+	}
+	mWindowSize = size;
+}
+
+void G2oSolver::setVerification(bool verify)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	mLogger->message(INFO, (boost::format("verify_edges:           %1%") % verify).str());
+	mVerifyEdges = verify;
+}
+
+bool G2oSolver::verifyNewEdges()
+{
+	bool ok = true;
+	for(g2o::HyperGraph::EdgeSet::iterator it = mInt->newEdges.begin(); it != mInt->newEdges.end(); ++it)
+	{
+		g2o::OptimizableGraph::Edge* e = static_cast<g2o::OptimizableGraph::Edge*>(*it);
+		Eigen::Map<const Eigen::MatrixXd> info(e->informationData(), e->dimension(), e->dimension());
+		if(!info.isApprox(info.transpose(), 1e-10))
+		{
+			mLogger->message(ERROR, (boost::format("Information matrix of edge at vertex %1% is not symmetric!")
+			 % e->vertices()[0]->id()).str());
+			ok = false;
+			continue;
+		}
+		Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigenSolver(info, Eigen::EigenvaluesOnly);
+		if(eigenSolver.eigenvalues()(0) < 0)
+		{
+			mLogger->message(ERROR, (boost::format("Information matrix of edge at vertex %1% is not positive semi-definite!")
+			 % e->vertices()[0]->id()).str());
+			ok = false;
+		}
+	}
+	return ok;
+}
+
 bool G2oSolver::compute(unsigned iterations)
 {
 	// Clear previous optimization result
@@ -170,8 +323,9 @@ bool G2oSolver::compute(unsigned iterations)
 	if(mInt->optimizer.activeVertices().size() == 0 && mInt->newVertices.size() < 2)
 		return true;
 	
-	// Check input
-	if(!mInt->optimizer.verifyInformationMatrices(true))
+	// Check input; only edges added since the last run are verified,
+	// older ones have already passed this check once.
+	if(mVerifyEdges && !verifyNewEdges())
 	{
 		mLogger->message(ERROR, "Failed to verify information matrices!");
 		return false;
@@ -185,7 +339,55 @@ bool G2oSolver::compute(unsigned iterations)
 	}
 	
 	// Do the graph optimization
-	if(mInitialized)
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if(mWindowSize > 0)
+	{
+		// Determine the window boundary from the highest vertex id
+		IdType maxId = 0;
+		for(g2o::HyperGraph::VertexIDMap::iterator it = mInt->optimizer.vertices().begin(); it != mInt->optimizer.vertices().end(); ++it)
+		{
+			maxId = std::max(maxId, (IdType)it->first);
+		}
+		IdType boundary = (maxId > mWindowSize) ? (maxId - mWindowSize) : 0;
+
+		// Collect all vertices within the window
+		mInt->window.clear();
+		for(g2o::HyperGraph::VertexIDMap::iterator it = mInt->optimizer.vertices().begin(); it != mInt->optimizer.vertices().end(); ++it)
+		{
+			if((IdType)it->first >= boundary)
+			{
+				mInt->window.insert(it->second);
+			}
+		}
+
+		// Add direct neighbors outside the window and fix them at their
+		// current estimate, so the connecting edges anchor the boundary.
+		g2o::HyperGraph::VertexSet anchors;
+		for(g2o::HyperGraph::VertexSet::iterator it = mInt->window.begin(); it != mInt->window.end(); ++it)
+		{
+			for(g2o::HyperGraph::EdgeSet::iterator e = (*it)->edges().begin(); e != (*it)->edges().end(); ++e)
+			{
+				for(size_t i = 0; i < (*e)->vertices().size(); ++i)
+				{
+					g2o::OptimizableGraph::Vertex* v = static_cast<g2o::OptimizableGraph::Vertex*>((*e)->vertices()[i]);
+					if(v && (IdType)v->id() < boundary && !v->fixed())
+					{
+						v->setFixed(true);
+						mFrozenVertices.insert(v->id());
+						anchors.insert(v);
+					}
+				}
+			}
+		}
+		mInt->window.insert(anchors.begin(), anchors.end());
+
+		mLogger->message(DEBUG, (boost::format("Optimizing a window of %1% vertices.") % mInt->window.size()).str());
+		mInt->optimizer.initializeOptimization(mInt->window);
+
+		// The active sub-graph changes with every window, so incremental
+		// updates only apply to full-history mode.
+		mInitialized = false;
+	}else if(mInitialized)
 	{
 		mLogger->message(DEBUG, "Update Initialization.");
 		mInt->optimizer.updateInitialization(mInt->newVertices, mInt->newEdges);
@@ -196,14 +398,23 @@ bool G2oSolver::compute(unsigned iterations)
 	}
 	mInt->newVertices.clear();
 	mInt->newEdges.clear();
-	
+	std::chrono::steady_clock::time_point initialized = std::chrono::steady_clock::now();
+
 	int iter = mInt->optimizer.optimize(iterations, false);
+
+	// Provide timing of this run, so the backend can be benchmarked per deployment
+	std::chrono::steady_clock::time_point finished = std::chrono::steady_clock::now();
+	mStatistics.initialization_time = std::chrono::duration<double>(initialized - start).count();
+	mStatistics.optimization_time = std::chrono::duration<double>(finished - initialized).count();
+	mStatistics.iterations = (iter > 0) ? iter : 0;
+
 	if (iter <= 0)
-	{		
+	{
 		mLogger->message(ERROR, "Optimization failed!");
 		return false;
 	}
-	mLogger->message(INFO ,(boost::format("Optimization finished after %1% iterations.") % iter).str());
+	mLogger->message(INFO ,(boost::format("Optimization finished after %1% iterations (init: %2%s, optimize: %3%s).")
+	 % iter % mStatistics.initialization_time % mStatistics.optimization_time).str());
 
 	// Write the result so it can be used by the mapper
 	g2o::SparseOptimizer::VertexContainer vertices = mInt->optimizer.activeVertices();
@@ -217,7 +428,7 @@ bool G2oSolver::compute(unsigned iterations)
 	return true;
 }
 
-IdPoseVector G2oSolver::getCorrections()
+const IdPoseVector& G2oSolver::getCorrections()
 {
 	return mCorrections;
 }
@@ -228,6 +439,7 @@ void G2oSolver::clear()
 	mInt->optimizer.clear();
 	mInitialized = false;
 	mCorrections.clear();
+	mReportedPoses.clear();
 }
 
 void G2oSolver::saveGraph(std::string filename)
@@ -29,8 +29,19 @@
 #include <slam3d/core/Solver.hpp>
 #include <boost/thread/mutex.hpp>
 
+#include <set>
+
 namespace slam3d
-{	
+{
+	/**
+	 * @enum LinearSolverType
+	 * @brief Linear solver backend used within each Levenberg iteration.
+	 * @details Which backend is fastest depends on the structure of the
+	 * graph; chain-like graphs with few loop closures behave differently
+	 * then densely connected ones.
+	 */
+	enum LinearSolverType {CHOLMOD, CSPARSE, EIGEN, PCG};
+
 	/**
 	 * @class G2oSolver
 	 * @brief A solver for graph otimization that uses the g2o-backend.
@@ -40,6 +51,17 @@ namespace slam3d
 	class G2oSolver : public Solver
 	{
 	public:
+		/**
+		 * @struct Statistics
+		 * @brief Timing of the last call to compute().
+		 */
+		struct Statistics
+		{
+			double initialization_time;
+			double optimization_time;
+			unsigned iterations;
+		};
+
 		G2oSolver(Logger* logger);
 		~G2oSolver();
 		
@@ -48,15 +70,60 @@ namespace slam3d
 		void addEdgeGravity(IdType vertex, GravityConstraint::Ptr grav);
 		void addEdgePosition(IdType vertex, PositionConstraint::Ptr pos);
 		void addEdgeOrientation(IdType vertex, OrientationConstraint::Ptr orient);
+		void removeVertex(IdType id);
 		void setFixed(IdType id);
 		bool compute(unsigned iterations);
+
+		/**
+		 * @brief Restrict optimization to a sliding window of recent vertices.
+		 * @details When set to a value greater then zero, compute() only
+		 * optimizes the given number of most recent vertices. Older vertices
+		 * that share an edge with the window are fixed at their current
+		 * estimate, so these edges act as priors on the window boundary.
+		 * This bounds the cost of compute() regardless of mission duration.
+		 * Setting the size back to 0 re-activates the full history, e.g.
+		 * for a final optimization before the map is exported.
+		 * @param size number of recent vertices to optimize (0: all)
+		 */
+		void setWindowSize(unsigned size);
+
+		/**
+		 * @brief Select the linear solver used within each iteration.
+		 * @details Replaces the optimization algorithm, so the next call
+		 * to compute() will initialize from scratch. Can be called at any
+		 * time, e.g. based on a configuration file, to select the fastest
+		 * backend for a given deployment without recompiling.
+		 * @param type one of CHOLMOD (default), CSPARSE, EIGEN or PCG
+		 * @param blockOrdering use block ordering to reduce fill-in (ignored by PCG)
+		 */
+		void setLinearSolver(LinearSolverType type, bool blockOrdering = true);
+
+		/**
+		 * @brief Get timing information of the last call to compute().
+		 */
+		const Statistics& getStatistics() const { return mStatistics; }
+
+		/**
+		 * @brief Enable or disable verification of information matrices.
+		 * @details Each edge is verified once, in the first compute() after
+		 * it has been added. When constraints are built from fixed
+		 * covariance templates, verification can be disabled entirely.
+		 * @param verify check new information matrices before optimizing
+		 */
+		void setVerification(bool verify);
 		void clear();
 		void saveGraph(std::string filename);
 		
-		IdPoseVector getCorrections();
-		
+		const IdPoseVector& getCorrections();
+
 	protected:
+		bool verifyNewEdges();
+
 		IdPoseVector mCorrections;
+		std::set<IdType> mFrozenVertices;
+		unsigned mWindowSize;
+		Statistics mStatistics;
+		bool mVerifyEdges;
 		bool mInitialized;
 		boost::mutex mMutex;
 
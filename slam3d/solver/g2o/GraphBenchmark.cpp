@@ -0,0 +1,200 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Synthetic pose-graph scaling benchmark for the Graph and Solver
+// backends. A deterministic generator builds a wandering trajectory with
+// configurable loop-closure density and a GPS-like second sensor, then
+// the full BoostGraph + G2oSolver pipeline is timed per operation at
+// each scale. Results are CSV on stdout, one row per operation:
+//
+//   graph_benchmark [loop_density] [scale ...]
+//
+// Defaults are a loop density of 0.05 at 10000, 50000 and 200000
+// vertices. Memory rows report the process high-water mark after each
+// scale, so growth between scales bounds the cost of that scale.
+
+#include "G2oSolver.hpp"
+#include <slam3d/graph/boost/BoostGraph.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <sys/resource.h>
+
+using namespace slam3d;
+
+namespace
+{
+	double timeNow()
+	{
+		return std::chrono::duration<double>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void report(unsigned scale, const std::string& operation, double seconds, std::size_t ops)
+	{
+		std::cout << scale << "," << operation << "," << seconds << ","
+		          << ops << "," << (std::size_t)(ops / seconds) << "\n";
+	}
+
+	// Resident-set high-water mark of the whole process in kilobytes
+	std::size_t memoryHighWater()
+	{
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return usage.ru_maxrss;
+	}
+
+	void runScale(unsigned scale, double loop_density)
+	{
+		Clock clock;
+		Logger logger(clock);
+		logger.setLogLevel(ERROR);
+
+		BoostGraph backend(&logger);
+		G2oSolver solver(&logger);
+
+		// Go through the base class, as the benchmark measures the
+		// public Graph interface the mapper uses
+		Graph& graph = backend;
+		graph.setSolver(&solver);
+
+		std::mt19937 rng(42);
+		std::uniform_real_distribution<double> unit(0.0, 1.0);
+		std::normal_distribution<double> noise(0.0, 0.02);
+
+		// Ground truth poses of the wandering trajectory, so loop
+		// closures and GPS fixes can be derived consistently
+		std::vector<Transform> truth;
+		truth.reserve(scale);
+
+		Transform pose = Transform::Identity();
+		double ingest = 0;
+		std::size_t loops = 0;
+		IdType anchor = 0;
+		for(unsigned i = 0; i < scale; i++)
+		{
+			truth.push_back(pose);
+			Measurement::Ptr m(new Measurement("Robot", "Scanner", Transform::Identity()));
+
+			double start = timeNow();
+			IdType id = graph.addVertex(m, pose);
+			if(id > 1)
+			{
+				Transform tf = truth[id - 2].inverse() * pose;
+				SE3Constraint::Ptr se3(new SE3Constraint("Scanner", tf, Covariance<6>::Identity()));
+				graph.addConstraint(id - 1, id, se3);
+			}
+			ingest += timeNow() - start;
+
+			// Close a loop against a random earlier part of the trajectory
+			if(id > 100 && unit(rng) < loop_density)
+			{
+				IdType target = 1 + (rng() % (id - 100));
+				Transform tf = truth[target - 1].inverse() * pose;
+				start = timeNow();
+				SE3Constraint::Ptr se3(new SE3Constraint("Scanner", tf, Covariance<6>::Identity()));
+				graph.addConstraint(target, id, se3);
+				ingest += timeNow() - start;
+				loops++;
+			}
+
+			// Every 10th vertex carries a GPS fix of the true position,
+			// chained like GpsSensor chains its unary constraints
+			if(id % 10 == 0)
+			{
+				start = timeNow();
+				PositionConstraint::Ptr fix(new PositionConstraint("gps",
+					pose.translation(), Covariance<3>::Identity(), Transform::Identity()));
+				graph.addConstraint(id, anchor, fix);
+				anchor = id;
+				ingest += timeNow() - start;
+			}
+
+			// Advance with a unit step and a slight random turn
+			pose = pose * Eigen::Translation<ScalarType, 3>(1, 0, 0)
+			            * Eigen::AngleAxis<ScalarType>(0.1 + noise(rng), Direction::UnitZ());
+		}
+		report(scale, "ingest", ingest, scale + loops + scale / 10);
+
+		double start = timeNow();
+		std::set<std::string> sensors;
+		sensors.insert("Scanner");
+		graph.buildNeighborIndex(sensors);
+		report(scale, "build_neighbor_index", timeNow() - start, scale);
+
+		unsigned queries = 1000;
+		start = timeNow();
+		for(unsigned i = 0; i < queries; i++)
+		{
+			graph.getNearbyVertices(truth[rng() % scale], 10.0);
+		}
+		report(scale, "nearby_vertices", timeNow() - start, queries);
+
+		queries = 100;
+		start = timeNow();
+		for(unsigned i = 0; i < queries; i++)
+		{
+			graph.getVerticesInRange(1 + (rng() % scale), 3);
+		}
+		report(scale, "vertices_in_range", timeNow() - start, queries);
+
+		start = timeNow();
+		for(unsigned i = 0; i < queries; i++)
+		{
+			graph.calculateGraphDistance(1 + (rng() % scale), 1 + (rng() % scale));
+		}
+		report(scale, "graph_distance", timeNow() - start, queries);
+
+		start = timeNow();
+		graph.optimize(10);
+		report(scale, "optimize", timeNow() - start, scale);
+
+		std::cout << scale << ",memory_kb," << memoryHighWater() << ",,\n";
+	}
+}
+
+int main(int argc, char** argv)
+{
+	double loop_density = (argc > 1) ? atof(argv[1]) : 0.05;
+	std::vector<unsigned> scales;
+	for(int i = 2; i < argc; i++)
+	{
+		scales.push_back(atoi(argv[i]));
+	}
+	if(scales.empty())
+	{
+		scales = {10000, 50000, 200000};
+	}
+
+	std::cout << "scale,operation,seconds,ops,ops_per_second\n";
+	for(unsigned scale : scales)
+	{
+		runScale(scale, loop_density);
+	}
+	return 0;
+}
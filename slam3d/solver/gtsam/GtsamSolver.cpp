@@ -0,0 +1,275 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "GtsamSolver.hpp"
+
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/navigation/AttitudeFactor.h>
+#include <gtsam/nonlinear/ISAM2.h>
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/slam/PoseRotationPrior.h>
+#include <gtsam/slam/PoseTranslationPrior.h>
+#include <gtsam/slam/PriorFactor.h>
+#include <gtsam/slam/dataset.h>
+
+#include <boost/format.hpp>
+
+using namespace slam3d;
+
+namespace
+{
+	// Our SE3 information matrices order translation before rotation,
+	// gtsam's Pose3 tangent space orders rotation first
+	gtsam::Matrix6 reorderInformation(const Covariance<6>& in)
+	{
+		gtsam::Matrix6 info;
+		info.block<3,3>(0,0) = in.block<3,3>(3,3);
+		info.block<3,3>(0,3) = in.block<3,3>(3,0);
+		info.block<3,3>(3,0) = in.block<3,3>(0,3);
+		info.block<3,3>(3,3) = in.block<3,3>(0,0);
+		return info;
+	}
+
+	gtsam::Pose3 toPose3(const Transform& tf)
+	{
+		return gtsam::Pose3(gtsam::Matrix4(tf.matrix()));
+	}
+
+	Transform toTransform(const gtsam::Pose3& pose)
+	{
+		Transform tf;
+		tf.matrix() = pose.matrix();
+		return tf;
+	}
+}
+
+struct GtsamSolver::Internal
+{
+	gtsam::ISAM2 isam;
+	gtsam::NonlinearFactorGraph newFactors;
+	gtsam::Values newValues;
+};
+
+GtsamSolver::GtsamSolver(Logger* logger) : Solver(logger), mInt(new Internal)
+{
+	mBatchSpan = 100;
+	mForceBatch = false;
+}
+
+GtsamSolver::~GtsamSolver()
+{
+}
+
+void GtsamSolver::setBatchSpan(IdType span)
+{
+	mLogger->message(INFO, (boost::format("batch_span:             %1%") % span).str());
+	mBatchSpan = span;
+}
+
+void GtsamSolver::addVertex(IdType id, const Transform& pose)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+
+	// Check that given id has not been added before
+	if(mVertices.find(id) != mVertices.end())
+	{
+		throw DuplicateVertex(id);
+	}
+
+	mInt->newValues.insert(id, toPose3(pose));
+	mVertices.insert(id);
+}
+
+void GtsamSolver::addEdgeSE3(IdType source, IdType target, SE3Constraint::Ptr se3)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+
+	if(mVertices.find(source) == mVertices.end() || mVertices.find(target) == mVertices.end())
+	{
+		throw BadEdge(source, target);
+	}
+
+	gtsam::SharedNoiseModel noise = gtsam::noiseModel::Gaussian::Information(
+		reorderInformation(se3->getInformation().cast<double>()));
+	mInt->newFactors.add(gtsam::BetweenFactor<gtsam::Pose3>(
+		source, target, toPose3(se3->getRelativePose().cast<double>()), noise));
+
+	// An edge between distant vertices closes a large loop; the next
+	// compute() falls back to iterating the update until it settles
+	IdType span = source > target ? source - target : target - source;
+	if(span > mBatchSpan)
+	{
+		mForceBatch = true;
+	}
+}
+
+void GtsamSolver::addEdgeGravity(IdType vertex, GravityConstraint::Ptr grav)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+
+	if(mVertices.find(vertex) == mVertices.end())
+	{
+		throw UnknownVertex(vertex);
+	}
+
+	gtsam::SharedNoiseModel noise = gtsam::noiseModel::Gaussian::Covariance(
+		grav->getCovariance().cast<double>());
+	mInt->newFactors.add(gtsam::Pose3AttitudeFactor(vertex,
+		gtsam::Unit3(grav->getReference()), noise, gtsam::Unit3(grav->getDirection())));
+}
+
+void GtsamSolver::addEdgePosition(IdType vertex, PositionConstraint::Ptr pos)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+
+	if(mVertices.find(vertex) == mVertices.end())
+	{
+		throw UnknownVertex(vertex);
+	}
+
+	gtsam::SharedNoiseModel noise = gtsam::noiseModel::Gaussian::Covariance(
+		pos->getCovariance().cast<double>());
+	mInt->newFactors.add(gtsam::PoseTranslationPrior<gtsam::Pose3>(
+		vertex, gtsam::Point3(pos->getPosition()), noise));
+}
+
+void GtsamSolver::addEdgeOrientation(IdType vertex, OrientationConstraint::Ptr orient)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+
+	if(mVertices.find(vertex) == mVertices.end())
+	{
+		throw UnknownVertex(vertex);
+	}
+
+	gtsam::SharedNoiseModel noise = gtsam::noiseModel::Gaussian::Covariance(
+		orient->getCovariance().cast<double>());
+	mInt->newFactors.add(gtsam::PoseRotationPrior<gtsam::Pose3>(
+		vertex, gtsam::Rot3(orient->getOrientation().toRotationMatrix()), noise));
+}
+
+void GtsamSolver::setFixed(IdType id)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+
+	if(mVertices.find(id) == mVertices.end())
+	{
+		mLogger->message(ERROR, (boost::format("Could not fix vertex with ID %1%!") % id).str());
+		throw UnknownVertex(id);
+	}
+
+	// The factorization has no notion of fixed vertices, so the vertex
+	// is held in place by a very tight prior on its current estimate
+	gtsam::Pose3 pose;
+	if(mInt->newValues.exists(id))
+	{
+		pose = mInt->newValues.at<gtsam::Pose3>(id);
+	}else
+	{
+		pose = mInt->isam.calculateEstimate<gtsam::Pose3>(id);
+	}
+	gtsam::SharedNoiseModel noise = gtsam::noiseModel::Isotropic::Sigma(6, 1e-6);
+	mInt->newFactors.add(gtsam::PriorFactor<gtsam::Pose3>(id, pose, noise));
+}
+
+bool GtsamSolver::compute(unsigned iterations)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+
+	// Clear previous optimization result
+	mCorrections.clear();
+
+	// need to do something?
+	if(mVertices.size() < 2)
+		return true;
+
+	try
+	{
+		// Update the factorization with what was added since the last
+		// call; only the affected variables are relinearized
+		gtsam::ISAM2Result result = mInt->isam.update(mInt->newFactors, mInt->newValues);
+		mInt->newFactors.resize(0);
+		mInt->newValues.clear();
+
+		if(mForceBatch)
+		{
+			// Batch fallback after a large loop closure: iterate the
+			// update until no more variables need relinearization
+			unsigned extra = 0;
+			while(result.variablesRelinearized > 0 && extra < iterations)
+			{
+				result = mInt->isam.update();
+				extra++;
+			}
+			mLogger->message(INFO, (boost::format("Batch fallback finished after %1% extra updates.") % extra).str());
+			mForceBatch = false;
+		}
+	}
+	catch(std::exception& e)
+	{
+		mLogger->message(ERROR, (boost::format("Optimization failed: %1%") % e.what()).str());
+		return false;
+	}
+
+	// Write the result so it can be used by the mapper
+	gtsam::Values estimate = mInt->isam.calculateEstimate();
+	gtsam::KeyVector keys = estimate.keys();
+	for(gtsam::KeyVector::const_iterator k = keys.begin(); k != keys.end(); ++k)
+	{
+		mCorrections.push_back(IdPose(*k, toTransform(estimate.at<gtsam::Pose3>(*k))));
+	}
+	return true;
+}
+
+const IdPoseVector& GtsamSolver::getCorrections()
+{
+	return mCorrections;
+}
+
+void GtsamSolver::clear()
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	mInt->isam = gtsam::ISAM2();
+	mInt->newFactors.resize(0);
+	mInt->newValues.clear();
+	mVertices.clear();
+	mCorrections.clear();
+	mReportedPoses.clear();
+	mForceBatch = false;
+}
+
+void GtsamSolver::saveGraph(std::string filename)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	try
+	{
+		gtsam::writeG2o(mInt->isam.getFactorsUnsafe(), mInt->isam.calculateEstimate(), filename);
+		mLogger->message(INFO, (boost::format("Saved current gtsam graph in %1%.") % filename).str());
+	}
+	catch(std::exception& e)
+	{
+		mLogger->message(ERROR, (boost::format("Could not save %1%.") % filename).str());
+	}
+}
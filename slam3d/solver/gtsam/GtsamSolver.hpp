@@ -0,0 +1,94 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM_GTSAM_SOLVER_HPP
+#define SLAM_GTSAM_SOLVER_HPP
+
+#include <slam3d/core/Solver.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <set>
+
+namespace slam3d
+{
+	/**
+	 * @class GtsamSolver
+	 * @brief A solver for graph optimization that uses incremental smoothing.
+	 * @details Built on GTSAM's iSAM2, which maintains a Bayes-tree
+	 * factorization of the graph. Unlike the batch backend, compute() only
+	 * updates the factorization with the vertices and edges added since
+	 * the last call and relinearizes just the affected variables, so the
+	 * per-scan cost scales with the size of the update instead of the
+	 * total graph size. When an edge closes a large loop, the next
+	 * compute() iterates the update until relinearization settles, which
+	 * corresponds to a batch solve. See: https://gtsam.org for
+	 * documentation on the backend.
+	 *
+	 * Limitations compared to G2oSolver: vertices cannot be removed, and
+	 * the sensor pose offset of position and orientation constraints is
+	 * not applied.
+	 */
+	class GtsamSolver : public Solver
+	{
+	public:
+		GtsamSolver(Logger* logger);
+		~GtsamSolver();
+
+		void addVertex(IdType id, const Transform& pose);
+		void addEdgeSE3(IdType source, IdType target, SE3Constraint::Ptr se3);
+		void addEdgeGravity(IdType vertex, GravityConstraint::Ptr grav);
+		void addEdgePosition(IdType vertex, PositionConstraint::Ptr pos);
+		void addEdgeOrientation(IdType vertex, OrientationConstraint::Ptr orient);
+		void setFixed(IdType id);
+		bool compute(unsigned iterations);
+		void clear();
+		void saveGraph(std::string filename);
+
+		const IdPoseVector& getCorrections();
+
+		/**
+		 * @brief Set the edge span that triggers the batch fallback.
+		 * @details An SE3 edge whose endpoints are more than this many
+		 * ids apart is treated as a large loop closure: the following
+		 * compute() iterates the incremental update until all affected
+		 * variables are relinearized.
+		 * @param span
+		 */
+		void setBatchSpan(IdType span);
+
+	protected:
+		IdPoseVector mCorrections;
+		std::set<IdType> mVertices;
+		IdType mBatchSpan;
+		bool mForceBatch;
+		boost::mutex mMutex;
+
+	private:
+		struct Internal;
+		std::unique_ptr<Internal> mInt;
+	};
+}
+
+#endif
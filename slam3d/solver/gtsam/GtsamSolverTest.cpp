@@ -0,0 +1,18 @@
+#define BOOST_TEST_MODULE "GtsamSolverTest"
+
+#include "GtsamSolver.hpp"
+
+#include <slam3d/core/FileLogger.hpp>
+#include <slam3d/core/SolverTest.hpp>
+
+using namespace slam3d;
+
+BOOST_AUTO_TEST_CASE(gtsam_optimization)
+{
+	Clock clock;
+	FileLogger logger(clock, "gtsam_solver.log");
+	logger.setLogLevel(DEBUG);
+	Solver* solver = new GtsamSolver(&logger);
+	test_optimization(solver);
+	delete solver;
+}